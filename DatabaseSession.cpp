@@ -0,0 +1,333 @@
+#include "DatabaseSession.h"
+
+#include <cstdio>
+#include <utility>
+
+#include "Types.h"
+
+static bool IsResultOK(const PGresult* pResult)
+{
+	const auto eResult = PQresultStatus(pResult);
+	return eResult == PGRES_COMMAND_OK || eResult == PGRES_TUPLES_OK;
+}
+
+CDatabaseSession::CDatabaseSession(const char* const* aKeywords, const char* const* aValues)
+: m_aKeywords(aKeywords)
+, m_aValues(aValues)
+{
+}
+
+CDatabaseSession::~CDatabaseSession()
+{
+	Close();
+}
+
+PGconn* CDatabaseSession::GetConnection()
+{
+	if (m_pDatabaseConnection == nullptr)
+	{
+		m_pDatabaseConnection = PQconnectdbParams(m_aKeywords, m_aValues, 0);
+	}
+	else if (PQstatus(m_pDatabaseConnection) != CONNECTION_OK)
+	{
+		printf("Lost the database connection, reconnecting\n");
+		PQreset(m_pDatabaseConnection);
+		m_setPreparedStatements.clear();
+	}
+
+	// A connection that failed is still handed back, queries on it fail with the reason
+	if (PQstatus(m_pDatabaseConnection) != CONNECTION_OK)
+	{
+		printf("Failed to connect to database: %s\n", PQerrorMessage(m_pDatabaseConnection));
+	}
+	return m_pDatabaseConnection;
+}
+
+void CDatabaseSession::Close()
+{
+	if (!m_vStatements.empty())
+	{
+		Flush();
+	}
+
+	if (m_pDatabaseConnection != nullptr)
+	{
+		PQfinish(m_pDatabaseConnection);
+		m_pDatabaseConnection = nullptr;
+	}
+	m_setPreparedStatements.clear();
+}
+
+PGresult* CDatabaseSession::ExecPrepared(const char* szName, const char* szStatement, const std::vector<std::string>& vParams, int nResultFormat)
+{
+	PGconn* pDatabaseConnection = GetConnection();
+	if (m_setPreparedStatements.count(szName) == 0)
+	{
+		PGresult* pResult = PQprepare(pDatabaseConnection, szName, szStatement, static_cast<int>(vParams.size()), nullptr);
+		if (PQresultStatus(pResult) != PGRES_COMMAND_OK)
+		{
+			printf("Failed to prepare statement: %s, query: %s\n", PQresultErrorMessage(pResult), szStatement);
+			return pResult;
+		}
+		PQclear(pResult);
+		m_setPreparedStatements.insert(szName);
+	}
+
+	std::vector<const char*> vParamValues;
+	for (const std::string& sParam : vParams)
+	{
+		vParamValues.push_back(sParam.c_str());
+	}
+	return PQexecPrepared(pDatabaseConnection, szName, static_cast<int>(vParams.size()), vParamValues.data(), nullptr, nullptr, nResultFormat);
+}
+
+void CDatabaseSession::Queue(const std::string& sStatement)
+{
+	Queue(sStatement, std::vector<std::string>(), std::vector<int>());
+}
+
+void CDatabaseSession::Queue(const std::string& sStatement, const std::vector<std::string>& vParams, const std::vector<int>& vParamFormats)
+{
+	SStatement statement;
+	statement.sStatement = sStatement;
+	statement.vParams = vParams;
+	statement.vParamFormats = vParamFormats;
+	statement.vParamFormats.resize(vParams.size(), 0);
+	m_vStatements.push_back(std::move(statement));
+}
+
+void CDatabaseSession::EndTransaction()
+{
+	if (!m_vStatements.empty())
+	{
+		m_vStatements.back().bEndsTransaction = true;
+	}
+}
+
+bool CDatabaseSession::Flush()
+{
+	std::vector<PGresult*> vResults;
+	const bool bFlushed = Flush(vResults);
+	for (PGresult* pResult : vResults)
+	{
+		PQclear(pResult);
+	}
+	return bFlushed;
+}
+
+bool CDatabaseSession::Flush(std::vector<PGresult*>& vResults)
+{
+	vResults.assign(m_vStatements.size(), nullptr);
+	if (m_vStatements.empty())
+	{
+		return true;
+	}
+	EndTransaction();
+
+	// A connection the server dropped while it sat idle only shows as lost once something is sent on it. Every statement queued replaces
+	// what it stores, so ones that ran before the connection was lost can run again.
+	bool bFlushed = FlushOnConnection(vResults);
+	if (!bFlushed && PQstatus(m_pDatabaseConnection) == CONNECTION_BAD)
+	{
+		printf("Lost the database connection while sending queued statements, sending them again\n");
+		for (PGresult*& pResult : vResults)
+		{
+			PQclear(pResult);
+			pResult = nullptr;
+		}
+		bFlushed = FlushOnConnection(vResults);
+	}
+
+	m_vStatements.clear();
+	return bFlushed;
+}
+
+bool CDatabaseSession::FlushOnConnection(std::vector<PGresult*>& vResults)
+{
+	PGconn* pDatabaseConnection = GetConnection();
+	if (PQstatus(pDatabaseConnection) != CONNECTION_OK)
+	{
+		return false;
+	}
+
+#if defined(LIBPQ_HAS_PIPELINING)
+	if (g_Env.bPipelineQueries)
+	{
+		return FlushPipelined(pDatabaseConnection, vResults);
+	}
+#endif // defined(LIBPQ_HAS_PIPELINING)
+	return FlushSequential(pDatabaseConnection, vResults);
+}
+
+// Every statement is sent before any result is read. The statements sent here are small next to the socket buffers, so the server is never
+// left blocked on unread results while libpq is still sending.
+bool CDatabaseSession::FlushPipelined(PGconn* pDatabaseConnection, std::vector<PGresult*>& vResults)
+{
+#if defined(LIBPQ_HAS_PIPELINING)
+	if (PQenterPipelineMode(pDatabaseConnection) == 0)
+	{
+		return FlushSequential(pDatabaseConnection, vResults);
+	}
+
+	// A statement that fails to send ends the pipeline early, the statements already sent still get their results read
+	size_t zNumSent = 0;
+	bool bSynced = true;
+	for (const SStatement& statement : m_vStatements)
+	{
+		std::vector<const char*> vParamValues;
+		std::vector<int> vParamLengths;
+		for (const std::string& sParam : statement.vParams)
+		{
+			vParamValues.push_back(sParam.data());
+			vParamLengths.push_back(static_cast<int>(sParam.size()));
+		}
+
+		if (PQsendQueryParams(pDatabaseConnection, statement.sStatement.c_str(), static_cast<int>(statement.vParams.size()), nullptr, vParamValues.data(), vParamLengths.data(),
+			statement.vParamFormats.data(), 0) == 0)
+		{
+			printf("Failed to send query: %s, query: %s\n", PQerrorMessage(pDatabaseConnection), statement.sStatement.c_str());
+			break;
+		}
+		++zNumSent;
+
+		bSynced = statement.bEndsTransaction;
+		if (bSynced && PQpipelineSync(pDatabaseConnection) == 0)
+		{
+			printf("Failed to sync pipeline: %s\n", PQerrorMessage(pDatabaseConnection));
+			bSynced = false;
+			break;
+		}
+	}
+	if (!bSynced && zNumSent > 0)
+	{
+		m_vStatements[zNumSent - 1].bEndsTransaction = true;
+		PQpipelineSync(pDatabaseConnection);
+	}
+
+	bool bFlushed = (zNumSent == m_vStatements.size());
+	for (size_t zStatement = 0 ; zStatement < zNumSent ; ++zStatement)
+	{
+		const SStatement& statement = m_vStatements[zStatement];
+		PGresult* pResult = PQgetResult(pDatabaseConnection);
+		if (pResult != nullptr)
+		{
+			// Each statement's results end with a nullptr
+			while (PGresult* pExtraResult = PQgetResult(pDatabaseConnection))
+			{
+				PQclear(pExtraResult);
+			}
+		}
+
+		if (!IsResultOK(pResult))
+		{
+			// Statements skipped because an earlier one in their transaction failed are only reported by that one
+			if (PQresultStatus(pResult) != PGRES_PIPELINE_ABORTED)
+			{
+				printf("Query failed: %s, query: %s\n", pResult != nullptr ? PQresultErrorMessage(pResult) : PQerrorMessage(pDatabaseConnection), statement.sStatement.c_str());
+			}
+			bFlushed = false;
+		}
+		vResults[zStatement] = pResult;
+
+		if (statement.bEndsTransaction)
+		{
+			PGresult* pSyncResult = PQgetResult(pDatabaseConnection);
+			if (PQresultStatus(pSyncResult) != PGRES_PIPELINE_SYNC)
+			{
+				bFlushed = false;
+			}
+			PQclear(pSyncResult);
+		}
+	}
+
+	// A lost connection is left for Flush() to make again, any other failure leaves the connection in a state only a reset gets it out of
+	if (PQexitPipelineMode(pDatabaseConnection) == 0)
+	{
+		printf("Failed to leave pipeline mode: %s\n", PQerrorMessage(pDatabaseConnection));
+		if (PQstatus(pDatabaseConnection) != CONNECTION_BAD)
+		{
+			PQreset(pDatabaseConnection);
+			m_setPreparedStatements.clear();
+		}
+		return false;
+	}
+
+	return bFlushed;
+#else
+	return FlushSequential(pDatabaseConnection, vResults);
+#endif // defined(LIBPQ_HAS_PIPELINING)
+}
+
+// One round trip per statement, with a transaction of more than one statement wrapped in BEGIN and COMMIT
+bool CDatabaseSession::FlushSequential(PGconn* pDatabaseConnection, std::vector<PGresult*>& vResults)
+{
+	bool bFlushed = true;
+	size_t zTransactionBegin = 0;
+	while (zTransactionBegin < m_vStatements.size())
+	{
+		size_t zTransactionEnd = zTransactionBegin;
+		while (!m_vStatements[zTransactionEnd].bEndsTransaction)
+		{
+			++zTransactionEnd;
+		}
+		++zTransactionEnd;
+
+		const bool bExplicitTransaction = (zTransactionEnd - zTransactionBegin > 1);
+		bool bTransactionOK = true;
+		if (bExplicitTransaction)
+		{
+			PGresult* pResult = PQexec(pDatabaseConnection, "BEGIN;");
+			bTransactionOK = IsResultOK(pResult);
+			if (!bTransactionOK)
+			{
+				printf("Transaction failed: %s, query: BEGIN;\n", PQresultErrorMessage(pResult));
+			}
+			PQclear(pResult);
+		}
+
+		for (size_t zStatement = zTransactionBegin ; zStatement < zTransactionEnd && bTransactionOK ; ++zStatement)
+		{
+			PGresult* pResult = Exec(pDatabaseConnection, m_vStatements[zStatement]);
+			bTransactionOK = IsResultOK(pResult);
+			if (!bTransactionOK)
+			{
+				printf("Query failed: %s, query: %s\n", PQresultErrorMessage(pResult), m_vStatements[zStatement].sStatement.c_str());
+			}
+			vResults[zStatement] = pResult;
+		}
+
+		if (bExplicitTransaction)
+		{
+			PGresult* pResult = PQexec(pDatabaseConnection, bTransactionOK ? "COMMIT;" : "ROLLBACK;");
+			if (bTransactionOK && !IsResultOK(pResult))
+			{
+				printf("Transaction failed: %s, query: COMMIT;\n", PQresultErrorMessage(pResult));
+				bTransactionOK = false;
+			}
+			PQclear(pResult);
+		}
+
+		bFlushed = bFlushed && bTransactionOK;
+		zTransactionBegin = zTransactionEnd;
+	}
+
+	return bFlushed;
+}
+
+PGresult* CDatabaseSession::Exec(PGconn* pDatabaseConnection, const SStatement& statement)
+{
+	if (statement.vParams.empty())
+	{
+		return PQexec(pDatabaseConnection, statement.sStatement.c_str());
+	}
+
+	std::vector<const char*> vParamValues;
+	std::vector<int> vParamLengths;
+	for (const std::string& sParam : statement.vParams)
+	{
+		vParamValues.push_back(sParam.data());
+		vParamLengths.push_back(static_cast<int>(sParam.size()));
+	}
+	return PQexecParams(pDatabaseConnection, statement.sStatement.c_str(), static_cast<int>(statement.vParams.size()), nullptr, vParamValues.data(), vParamLengths.data(),
+		statement.vParamFormats.data(), 0);
+}
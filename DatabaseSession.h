@@ -0,0 +1,64 @@
+#if !defined(DATABASESESSION_H)
+#define DATABASESESSION_H
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <libpq-fe.h>
+
+// The process's one database connection, made the first time it's needed and kept until the process exits.
+// Statements that don't need their results straight away are queued and sent together by Flush(), in one round trip with libpq's pipeline mode.
+// Queued statements are grouped into transactions, each committed on its own, so one failing doesn't lose the others.
+class CDatabaseSession
+{
+public:
+	CDatabaseSession(const char* const* aKeywords, const char* const* aValues);
+	~CDatabaseSession();
+	CDatabaseSession(const CDatabaseSession&) = delete;
+	CDatabaseSession& operator=(const CDatabaseSession&) = delete;
+
+	// Connects, or reconnects if the connection was lost. A connection that couldn't be made is still returned, queries on it fail with the reason.
+	// Call it again before each use rather than keeping the connection, so one lost in between is made again.
+	PGconn* GetConnection();
+	void Close();
+
+	// Runs a statement prepared on the connection the first time it's run, and again after reconnecting. Parameters are text,
+	// results are text (0) or binary (1). The result is the caller's to PQclear().
+	PGresult* ExecPrepared(const char* szName, const char* szStatement, const std::vector<std::string>& vParams, int nResultFormat);
+
+	// Adds a statement to the open transaction. Parameters are text unless vParamFormats marks them binary (1).
+	void Queue(const std::string& sStatement);
+	void Queue(const std::string& sStatement, const std::vector<std::string>& vParams, const std::vector<int>& vParamFormats);
+	// Statements queued after this go in a new transaction
+	void EndTransaction();
+
+	// Sends every queued statement, returning false if any of them failed. The results of each statement are handed back in queued order
+	// if asked for, they're the caller's to PQclear(), with nullptr for a statement that wasn't run.
+	// If the connection is lost while sending, it's made again and every statement is sent once more, so queue only statements that
+	// can safely run twice.
+	bool Flush();
+	bool Flush(std::vector<PGresult*>& vResults);
+
+private:
+	struct SStatement
+	{
+		std::string sStatement;
+		std::vector<std::string> vParams;
+		std::vector<int> vParamFormats;
+		bool bEndsTransaction = false;
+	};
+
+	bool FlushOnConnection(std::vector<PGresult*>& vResults);
+	bool FlushPipelined(PGconn* pDatabaseConnection, std::vector<PGresult*>& vResults);
+	bool FlushSequential(PGconn* pDatabaseConnection, std::vector<PGresult*>& vResults);
+	PGresult* Exec(PGconn* pDatabaseConnection, const SStatement& statement);
+
+	const char* const* m_aKeywords = nullptr;
+	const char* const* m_aValues = nullptr;
+	PGconn* m_pDatabaseConnection = nullptr;
+	std::set<std::string> m_setPreparedStatements; // On the current connection
+	std::vector<SStatement> m_vStatements;
+};
+
+#endif // !defined(DATABASESESSION_H)
@@ -0,0 +1,479 @@
+#include "EnvironmentSnapshot.h"
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#define _WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#undef min
+#undef max
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // defined(_WIN32)
+
+#include "Utils.h"
+
+static const uint32_t s_nEnvironmentSnapshotMagic = 0x53454442; // "BDES"
+static const uint32_t s_nEnvironmentSnapshotFormat = 1;
+
+// Followed by the categories, knowledge, constellations, targets, category knowledge IDs, slot orders and names, each starting 8 byte aligned
+struct SSnapshotHeader
+{
+	uint32_t nMagic;
+	uint32_t nFormat;
+	uint32_t nNumCategories;
+	uint32_t nNumKnowledge;
+	uint32_t nNumConstellations;
+	uint32_t nNumTargets;
+	uint32_t nNumCategoryKnowledge;
+	uint32_t nNumSlotOrders;
+	uint64_t zNamesSize;
+	uint64_t zDataSize; // Everything after the header
+	uint64_t nChecksum; // Of everything after the header
+};
+
+// Names are offsets into the name pool
+struct SSnapshotName
+{
+	uint32_t nOffset;
+	uint32_t nLength;
+};
+
+struct SSnapshotCategory
+{
+	int32_t nID;
+	uint32_t nFirstKnowledge; // Into the category knowledge IDs, in the order the category lists them
+	uint32_t nNumKnowledge;
+	SSnapshotName name;
+};
+
+struct SSnapshotKnowledge
+{
+	double fInterest;
+	int32_t nID;
+	int32_t nFavorMin;
+	int32_t nFavorMax;
+	int32_t nComboDelay;
+	int32_t nComboLength;
+	int32_t nComboInterest;
+	int32_t nComboFavor;
+	SSnapshotName name;
+};
+
+struct SSnapshotConstellation
+{
+	int32_t nID;
+	int32_t nNumSlots;
+	uint32_t nFirstSlotOrder; // Into the slot orders
+	uint32_t nNumSlotOrder;
+};
+
+struct SSnapshotTarget
+{
+	int32_t nID;
+	int32_t nConstellationID;
+	int32_t nKnowledgeCategoryID;
+	int32_t nInterestMin;
+	int32_t nInterestMax;
+	int32_t nFavorMin;
+	int32_t nFavorMax;
+	SSnapshotName name;
+};
+
+static size_t GetAlignedSize(size_t zSize)
+{
+	return (zSize + 7) / 8 * 8;
+}
+
+// FNV-1a
+static uint64_t GetSnapshotChecksum(const unsigned char* pData, size_t zSize)
+{
+	uint64_t nHash = 14695981039346656037ull;
+	for (size_t zByte = 0 ; zByte < zSize ; ++zByte)
+	{
+		nHash = (nHash ^ pData[zByte]) * 1099511628211ull;
+	}
+	return nHash;
+}
+
+// Where each section starts, relative to the end of the header
+struct SSnapshotLayout
+{
+	SSnapshotLayout(const SSnapshotHeader& header)
+	{
+		zCategories = 0;
+		zKnowledge = zCategories + GetAlignedSize(header.nNumCategories * sizeof(SSnapshotCategory));
+		zConstellations = zKnowledge + GetAlignedSize(header.nNumKnowledge * sizeof(SSnapshotKnowledge));
+		zTargets = zConstellations + GetAlignedSize(header.nNumConstellations * sizeof(SSnapshotConstellation));
+		zCategoryKnowledge = zTargets + GetAlignedSize(header.nNumTargets * sizeof(SSnapshotTarget));
+		zSlotOrders = zCategoryKnowledge + GetAlignedSize(header.nNumCategoryKnowledge * sizeof(TKnowledgeID));
+		zNames = zSlotOrders + GetAlignedSize(header.nNumSlotOrders * sizeof(int32_t));
+		zDataSize = zNames + GetAlignedSize(static_cast<size_t>(header.zNamesSize));
+	}
+
+	size_t zCategories;
+	size_t zKnowledge;
+	size_t zConstellations;
+	size_t zTargets;
+	size_t zCategoryKnowledge;
+	size_t zSlotOrders;
+	size_t zNames;
+	size_t zDataSize;
+};
+
+static SSnapshotName AddSnapshotName(std::string& sNames, const std::string& sName)
+{
+	SSnapshotName name;
+	name.nOffset = static_cast<uint32_t>(sNames.size());
+	name.nLength = static_cast<uint32_t>(sName.size());
+	sNames += sName;
+	return name;
+}
+
+bool WriteEnvironmentSnapshot(const char* szPath)
+{
+	SSnapshotHeader header = {};
+	header.nMagic = s_nEnvironmentSnapshotMagic;
+	header.nFormat = s_nEnvironmentSnapshotFormat;
+	header.nNumCategories = static_cast<uint32_t>(g_Env.mapKnowledgeCategories.size());
+	header.nNumKnowledge = static_cast<uint32_t>(g_Env.mapKnowledges.size());
+	header.nNumConstellations = static_cast<uint32_t>(g_Env.mapConstellations.size());
+	header.nNumTargets = static_cast<uint32_t>(g_Env.mapTargets.size());
+
+	std::vector<SSnapshotCategory> vCategories;
+	std::vector<TKnowledgeID> vCategoryKnowledge;
+	std::string sNames;
+	for (const auto& pairCategory : g_Env.mapKnowledgeCategories)
+	{
+		const SKnowledgeCategory& category = pairCategory.second;
+		SSnapshotCategory snapshotCategory = {};
+		snapshotCategory.nID = category.nID;
+		snapshotCategory.nFirstKnowledge = static_cast<uint32_t>(vCategoryKnowledge.size());
+		snapshotCategory.nNumKnowledge = static_cast<uint32_t>(category.vKnowledge.size());
+		snapshotCategory.name = AddSnapshotName(sNames, category.sName);
+		vCategories.push_back(snapshotCategory);
+		vCategoryKnowledge.insert(vCategoryKnowledge.end(), category.vKnowledge.begin(), category.vKnowledge.end());
+	}
+
+	std::vector<SSnapshotKnowledge> vKnowledge;
+	for (const auto& pairKnowledge : g_Env.mapKnowledges)
+	{
+		const SKnowledge& knowledge = pairKnowledge.second;
+		SSnapshotKnowledge snapshotKnowledge = {};
+		snapshotKnowledge.fInterest = knowledge.fInterest;
+		snapshotKnowledge.nID = knowledge.nID;
+		snapshotKnowledge.nFavorMin = knowledge.nFavorMin;
+		snapshotKnowledge.nFavorMax = knowledge.nFavorMax;
+		snapshotKnowledge.nComboDelay = knowledge.comboEffect.nDelay;
+		snapshotKnowledge.nComboLength = knowledge.comboEffect.nLength;
+		snapshotKnowledge.nComboInterest = knowledge.comboEffect.nInterest;
+		snapshotKnowledge.nComboFavor = knowledge.comboEffect.nFavor;
+		snapshotKnowledge.name = AddSnapshotName(sNames, knowledge.sName);
+		vKnowledge.push_back(snapshotKnowledge);
+	}
+
+	std::vector<SSnapshotConstellation> vConstellations;
+	std::vector<int32_t> vSlotOrders;
+	for (const auto& pairConstellation : g_Env.mapConstellations)
+	{
+		const SConstellation& constellation = pairConstellation.second;
+		SSnapshotConstellation snapshotConstellation = {};
+		snapshotConstellation.nID = constellation.nID;
+		snapshotConstellation.nNumSlots = constellation.nNumSlots;
+		snapshotConstellation.nFirstSlotOrder = static_cast<uint32_t>(vSlotOrders.size());
+		snapshotConstellation.nNumSlotOrder = static_cast<uint32_t>(constellation.vSlotOrder.size());
+		vConstellations.push_back(snapshotConstellation);
+		vSlotOrders.insert(vSlotOrders.end(), constellation.vSlotOrder.begin(), constellation.vSlotOrder.end());
+	}
+
+	std::vector<SSnapshotTarget> vTargets;
+	for (const auto& pairTarget : g_Env.mapTargets)
+	{
+		const STarget& target = pairTarget.second;
+		SSnapshotTarget snapshotTarget = {};
+		snapshotTarget.nID = target.nID;
+		snapshotTarget.nConstellationID = target.nConstellationID;
+		snapshotTarget.nKnowledgeCategoryID = target.nKnowledgeCategoryID;
+		snapshotTarget.nInterestMin = target.nInterestMin;
+		snapshotTarget.nInterestMax = target.nInterestMax;
+		snapshotTarget.nFavorMin = target.nFavorMin;
+		snapshotTarget.nFavorMax = target.nFavorMax;
+		snapshotTarget.name = AddSnapshotName(sNames, target.sName);
+		vTargets.push_back(snapshotTarget);
+	}
+
+	header.nNumCategoryKnowledge = static_cast<uint32_t>(vCategoryKnowledge.size());
+	header.nNumSlotOrders = static_cast<uint32_t>(vSlotOrders.size());
+	header.zNamesSize = sNames.size();
+
+	const SSnapshotLayout layout(header);
+	std::vector<unsigned char> vData(layout.zDataSize, 0);
+	auto Copy = [&](size_t zOffset, const void* pSource, size_t zSize)
+	{
+		if (zSize > 0)
+		{
+			memcpy(vData.data() + zOffset, pSource, zSize);
+		}
+	};
+	Copy(layout.zCategories, vCategories.data(), vCategories.size() * sizeof(SSnapshotCategory));
+	Copy(layout.zKnowledge, vKnowledge.data(), vKnowledge.size() * sizeof(SSnapshotKnowledge));
+	Copy(layout.zConstellations, vConstellations.data(), vConstellations.size() * sizeof(SSnapshotConstellation));
+	Copy(layout.zTargets, vTargets.data(), vTargets.size() * sizeof(SSnapshotTarget));
+	Copy(layout.zCategoryKnowledge, vCategoryKnowledge.data(), vCategoryKnowledge.size() * sizeof(TKnowledgeID));
+	Copy(layout.zSlotOrders, vSlotOrders.data(), vSlotOrders.size() * sizeof(int32_t));
+	Copy(layout.zNames, sNames.data(), sNames.size());
+
+	header.zDataSize = vData.size();
+	header.nChecksum = GetSnapshotChecksum(vData.data(), vData.size());
+
+	// Every process that reads the database writes the snapshot, each to a temporary file of its own
+	const std::string sPath = szPath;
+#if defined(_WIN32)
+	const std::string sTempPath = sPath + "." + std::to_string(GetCurrentProcessId()) + ".tmp";
+#else
+	const std::string sTempPath = sPath + "." + std::to_string(getpid()) + ".tmp";
+#endif // defined(_WIN32)
+	FILE* pFile = fopen(sTempPath.c_str(), "wb");
+	if (pFile == nullptr)
+	{
+		printf("Failed to open environment snapshot file: %s\n", sTempPath.c_str());
+		return false;
+	}
+
+	bool bWritten = (fwrite(&header, sizeof(header), 1, pFile) == 1);
+	bWritten = bWritten && (vData.empty() || fwrite(vData.data(), vData.size(), 1, pFile) == 1);
+	bWritten = (fclose(pFile) == 0) && bWritten;
+	if (!bWritten)
+	{
+		printf("Failed to write environment snapshot file: %s\n", sTempPath.c_str());
+		remove(sTempPath.c_str());
+		return false;
+	}
+
+#if defined(_WIN32)
+	const bool bRenamed = (MoveFileExA(sTempPath.c_str(), sPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != FALSE);
+#else
+	const bool bRenamed = (rename(sTempPath.c_str(), sPath.c_str()) == 0);
+#endif // defined(_WIN32)
+	if (!bRenamed)
+	{
+		printf("Failed to replace environment snapshot file: %s\n", sPath.c_str());
+		return false;
+	}
+
+	printf("Wrote %llu byte environment snapshot: %s\n", static_cast<unsigned long long>(sizeof(header) + vData.size()), sPath.c_str());
+	return true;
+}
+
+static bool LoadEnvironmentSnapshot(const unsigned char* pFile, size_t zFileSize)
+{
+	if (zFileSize < sizeof(SSnapshotHeader))
+	{
+		return false;
+	}
+
+	SSnapshotHeader header;
+	memcpy(&header, pFile, sizeof(header));
+	if (header.nMagic != s_nEnvironmentSnapshotMagic || header.nFormat != s_nEnvironmentSnapshotFormat || header.zDataSize != zFileSize - sizeof(header))
+	{
+		return false;
+	}
+
+	const SSnapshotLayout layout(header);
+	const unsigned char* pData = pFile + sizeof(header);
+	if (layout.zDataSize != header.zDataSize || GetSnapshotChecksum(pData, layout.zDataSize) != header.nChecksum)
+	{
+		return false;
+	}
+
+	// The header's counts are checked against the file size by the layout, the offsets inside records are checked as they're used
+	const SSnapshotCategory* pCategories = reinterpret_cast<const SSnapshotCategory*>(pData + layout.zCategories);
+	const SSnapshotKnowledge* pKnowledge = reinterpret_cast<const SSnapshotKnowledge*>(pData + layout.zKnowledge);
+	const SSnapshotConstellation* pConstellations = reinterpret_cast<const SSnapshotConstellation*>(pData + layout.zConstellations);
+	const SSnapshotTarget* pTargets = reinterpret_cast<const SSnapshotTarget*>(pData + layout.zTargets);
+	const TKnowledgeID* pCategoryKnowledge = reinterpret_cast<const TKnowledgeID*>(pData + layout.zCategoryKnowledge);
+	const int32_t* pSlotOrders = reinterpret_cast<const int32_t*>(pData + layout.zSlotOrders);
+	const char* pNames = reinterpret_cast<const char*>(pData + layout.zNames);
+
+	auto IsNameValid = [&](const SSnapshotName& name)
+	{
+		return static_cast<uint64_t>(name.nOffset) + name.nLength <= header.zNamesSize;
+	};
+	auto GetName = [&](const SSnapshotName& name)
+	{
+		return std::string(pNames + name.nOffset, name.nLength);
+	};
+
+	// Loaded on the side, so g_Env is only replaced once the whole file checks out
+	std::map<int, SKnowledgeCategory> mapKnowledgeCategories;
+	std::map<std::string, int> mapKnowledgeCategoryIDs;
+	std::map<TKnowledgeID, SKnowledge> mapKnowledges;
+	std::map<std::string, TKnowledgeID> mapKnowledgeIDs;
+	std::map<int, SConstellation> mapConstellations;
+	std::map<int, STarget> mapTargets;
+	std::map<std::string, int> mapTargetIDs;
+	for (uint32_t nCategory = 0 ; nCategory < header.nNumCategories ; ++nCategory)
+	{
+		const SSnapshotCategory& snapshotCategory = pCategories[nCategory];
+		if (!IsNameValid(snapshotCategory.name) || static_cast<uint64_t>(snapshotCategory.nFirstKnowledge) + snapshotCategory.nNumKnowledge > header.nNumCategoryKnowledge)
+		{
+			return false;
+		}
+
+		SKnowledgeCategory& category = mapKnowledgeCategories[snapshotCategory.nID];
+		category.nID = snapshotCategory.nID;
+		category.sName = GetName(snapshotCategory.name);
+		category.vKnowledge.assign(pCategoryKnowledge + snapshotCategory.nFirstKnowledge, pCategoryKnowledge + snapshotCategory.nFirstKnowledge + snapshotCategory.nNumKnowledge);
+
+		mapKnowledgeCategoryIDs[GetLowerString(category.sName)] = category.nID;
+	}
+
+	for (uint32_t nKnowledge = 0 ; nKnowledge < header.nNumKnowledge ; ++nKnowledge)
+	{
+		const SSnapshotKnowledge& snapshotKnowledge = pKnowledge[nKnowledge];
+		if (!IsNameValid(snapshotKnowledge.name))
+		{
+			return false;
+		}
+
+		const TKnowledgeID nKnowledgeID = static_cast<TKnowledgeID>(snapshotKnowledge.nID);
+		SKnowledge& knowledge = mapKnowledges[nKnowledgeID];
+		knowledge.nID = nKnowledgeID;
+		knowledge.sName = GetName(snapshotKnowledge.name);
+		knowledge.nFavorMin = snapshotKnowledge.nFavorMin;
+		knowledge.nFavorMax = snapshotKnowledge.nFavorMax;
+		knowledge.fInterest = snapshotKnowledge.fInterest;
+		knowledge.comboEffect.nDelay = snapshotKnowledge.nComboDelay;
+		knowledge.comboEffect.nLength = snapshotKnowledge.nComboLength;
+		knowledge.comboEffect.nInterest = snapshotKnowledge.nComboInterest;
+		knowledge.comboEffect.nFavor = snapshotKnowledge.nComboFavor;
+		knowledge.Finalize();
+
+		mapKnowledgeIDs[GetLowerString(knowledge.sName)] = nKnowledgeID;
+	}
+
+	for (uint32_t nConstellation = 0 ; nConstellation < header.nNumConstellations ; ++nConstellation)
+	{
+		const SSnapshotConstellation& snapshotConstellation = pConstellations[nConstellation];
+		if (static_cast<uint64_t>(snapshotConstellation.nFirstSlotOrder) + snapshotConstellation.nNumSlotOrder > header.nNumSlotOrders)
+		{
+			return false;
+		}
+
+		SConstellation& constellation = mapConstellations[snapshotConstellation.nID];
+		constellation.nID = snapshotConstellation.nID;
+		constellation.nNumSlots = snapshotConstellation.nNumSlots;
+		constellation.vSlotOrder.assign(pSlotOrders + snapshotConstellation.nFirstSlotOrder, pSlotOrders + snapshotConstellation.nFirstSlotOrder + snapshotConstellation.nNumSlotOrder);
+	}
+
+	for (uint32_t nTarget = 0 ; nTarget < header.nNumTargets ; ++nTarget)
+	{
+		const SSnapshotTarget& snapshotTarget = pTargets[nTarget];
+		if (!IsNameValid(snapshotTarget.name))
+		{
+			return false;
+		}
+
+		STarget& target = mapTargets[snapshotTarget.nID];
+		target.nID = snapshotTarget.nID;
+		target.sName = GetName(snapshotTarget.name);
+		target.nConstellationID = snapshotTarget.nConstellationID;
+		target.nKnowledgeCategoryID = snapshotTarget.nKnowledgeCategoryID;
+		target.nInterestMin = snapshotTarget.nInterestMin;
+		target.nInterestMax = snapshotTarget.nInterestMax;
+		target.nFavorMin = snapshotTarget.nFavorMin;
+		target.nFavorMax = snapshotTarget.nFavorMax;
+
+		mapTargetIDs[GetLowerString(target.sName)] = target.nID;
+	}
+
+	g_Env.mapKnowledgeCategories = std::move(mapKnowledgeCategories);
+	g_Env.mapKnowledgeCategoryIDs = std::move(mapKnowledgeCategoryIDs);
+	g_Env.mapKnowledges = std::move(mapKnowledges);
+	g_Env.mapKnowledgeIDs = std::move(mapKnowledgeIDs);
+	g_Env.mapConstellations = std::move(mapConstellations);
+	g_Env.mapTargets = std::move(mapTargets);
+	g_Env.mapTargetIDs = std::move(mapTargetIDs);
+	return true;
+}
+
+bool LoadEnvironmentSnapshot(const char* szPath)
+{
+	if (szPath == nullptr)
+	{
+		return false;
+	}
+
+	const unsigned char* pFile = nullptr;
+	size_t zFileSize = 0;
+#if defined(_WIN32)
+	HANDLE hFile = CreateFileA(szPath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	HANDLE hMapping = nullptr;
+	if (GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart > 0)
+	{
+		hMapping = CreateFileMappingA(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	}
+	if (hMapping != nullptr)
+	{
+		pFile = static_cast<const unsigned char*>(MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0));
+		zFileSize = static_cast<size_t>(fileSize.QuadPart);
+	}
+#else
+	const int nFile = open(szPath, O_RDONLY);
+	if (nFile < 0)
+	{
+		return false;
+	}
+
+	struct stat fileStat;
+	if (fstat(nFile, &fileStat) == 0 && fileStat.st_size > 0)
+	{
+		void* pMapping = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, nFile, 0);
+		if (pMapping != MAP_FAILED)
+		{
+			pFile = static_cast<const unsigned char*>(pMapping);
+			zFileSize = static_cast<size_t>(fileStat.st_size);
+		}
+	}
+#endif // defined(_WIN32)
+
+	const bool bLoaded = (pFile != nullptr) && LoadEnvironmentSnapshot(pFile, zFileSize);
+	if (pFile != nullptr && !bLoaded)
+	{
+		printf("Environment snapshot is from another format or corrupt: %s\n", szPath);
+	}
+
+#if defined(_WIN32)
+	if (pFile != nullptr)
+	{
+		UnmapViewOfFile(pFile);
+	}
+	if (hMapping != nullptr)
+	{
+		CloseHandle(hMapping);
+	}
+	CloseHandle(hFile);
+#else
+	if (pFile != nullptr)
+	{
+		munmap(const_cast<unsigned char*>(pFile), zFileSize);
+	}
+	close(nFile);
+#endif // defined(_WIN32)
+
+	return bLoaded;
+}
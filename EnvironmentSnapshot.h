@@ -0,0 +1,15 @@
+#if !defined(ENVIRONMENTSNAPSHOT_H)
+#define ENVIRONMENTSNAPSHOT_H
+
+#include "Types.h"
+
+// The knowledge categories, knowledge, constellations and targets g_Env is loaded with, saved to a file so a process can start up without
+// a database connection. The file is memory mapped and read as fixed size records plus a pool of names, there's nothing to parse.
+// It has no way of knowing the database changed, write it again after editing those tables.
+
+// Writes the data g_Env was loaded with, replacing the file in one step so a process loading it never sees it half written
+bool WriteEnvironmentSnapshot(const char* szPath);
+// Fills in g_Env from the file, leaving it untouched if the file is missing, from another format or fails its checksum
+bool LoadEnvironmentSnapshot(const char* szPath);
+
+#endif // !defined(ENVIRONMENTSNAPSHOT_H)
@@ -0,0 +1,438 @@
+#include "ResultsCache.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#if defined(_WIN32)
+#define _WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#undef min
+#undef max
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // defined(_WIN32)
+
+static const uint32_t s_nResultsCacheMagic = 0x43524442; // "BDRC"
+static const uint32_t s_nResultsCacheFormat = 4;
+
+// A write takes microseconds, a slot that has been busy this long belongs to a writer that died
+static const int64_t s_nStaleWriteMilliseconds = 10000;
+
+struct SResultsCacheFileHeader
+{
+	uint32_t nMagic;
+	uint32_t nFormat;
+	uint32_t nNumParams;
+	uint32_t nNumSlots;
+	uint64_t zSlotSize;
+};
+
+// Odd sequence numbers mark a slot that's being written, every write bumps it by 2. Writers stamp the time before they start, so a slot
+// left odd can be told apart from one being written.
+struct SResultsCacheFileSlot
+{
+	std::atomic<uint32_t> nSequence;
+	int32_t nTargetID;
+	int32_t nInterestLevel;
+	int32_t nFavor;
+	int32_t nVersion;
+	std::atomic<int64_t> nWriteTime; // Milliseconds since the epoch
+};
+
+struct SResultsCacheFileParam
+{
+	double fStrictEV;
+	double fSuccessPercentage;
+	uint16_t nNumKnowledge; // 0 for goal params that haven't been cached
+	TKnowledgeID aKnowledge[MAX_CONSTELLATION_SLOTS];
+};
+
+// Goal params are laid out one goal after another in every slot
+static int GetFileParamIndex(EGoal eGoal, int nGoalParam)
+{
+	static const std::array<int, NUM_GOALS + 1> s_aGoalOffsets = []()
+	{
+		const SBestCombinations bestCombinations;
+		std::array<int, NUM_GOALS + 1> aGoalOffsets;
+		aGoalOffsets[0] = 0;
+		for (int nGoal = 0 ; nGoal < NUM_GOALS ; ++nGoal)
+		{
+			aGoalOffsets[nGoal + 1] = aGoalOffsets[nGoal] + static_cast<int>(bestCombinations.aBestCombinations[nGoal].size());
+		}
+		return aGoalOffsets;
+	}();
+	return (eGoal < NUM_GOALS) ? s_aGoalOffsets[eGoal] + nGoalParam : s_aGoalOffsets[NUM_GOALS];
+}
+
+static size_t GetFileSlotSize()
+{
+	const size_t zSize = sizeof(SResultsCacheFileSlot) + GetFileParamIndex(NUM_GOALS, 0) * sizeof(SResultsCacheFileParam);
+	return (zSize + 63) / 64 * 64;
+}
+
+static SResultsCacheFileSlot* GetFileSlot(unsigned char* pFile, int nSlot)
+{
+	return reinterpret_cast<SResultsCacheFileSlot*>(pFile + sizeof(SResultsCacheFileHeader) + nSlot * GetFileSlotSize());
+}
+
+static SResultsCacheFileParam* GetFileParams(SResultsCacheFileSlot* pSlot)
+{
+	return reinterpret_cast<SResultsCacheFileParam*>(pSlot + 1);
+}
+
+static bool IsFileSlotState(const SResultsCacheFileSlot& slot, const SResultsCacheKey& key)
+{
+	return slot.nSequence.load(std::memory_order_relaxed) != 0 && slot.nTargetID == key.nTargetID && slot.nInterestLevel == key.nInterestLevel && slot.nFavor == key.nFavor;
+}
+
+static bool IsFileSlotKey(const SResultsCacheFileSlot& slot, const SResultsCacheKey& key)
+{
+	return IsFileSlotState(slot, key) && slot.nVersion == key.nVersion;
+}
+
+// First of the slots a key may be cached in, it's in one of the g_Env.nResultsCacheFileProbes slots from there.
+// Only the target state is hashed, so storing one version of a state can find and drop the others.
+static int GetFirstFileSlot(const SResultsCacheKey& key)
+{
+	uint32_t nHash = 2166136261u;
+	for (int nValue : { key.nTargetID, key.nInterestLevel, key.nFavor })
+	{
+		nHash = (nHash ^ static_cast<uint32_t>(nValue)) * 16777619u;
+	}
+	return static_cast<int>(nHash % static_cast<uint32_t>(g_Env.nResultsCacheFileSlots));
+}
+
+CResultsCache::~CResultsCache()
+{
+	Close();
+}
+
+static bool IsCurrentFileLayout(const unsigned char* pFile)
+{
+	const SResultsCacheFileHeader& header = *reinterpret_cast<const SResultsCacheFileHeader*>(pFile);
+	return header.nMagic == s_nResultsCacheMagic && header.nFormat == s_nResultsCacheFormat && header.nNumParams == static_cast<uint32_t>(GetFileParamIndex(NUM_GOALS, 0)) &&
+		header.nNumSlots == static_cast<uint32_t>(g_Env.nResultsCacheFileSlots) && header.zSlotSize == GetFileSlotSize();
+}
+
+bool CResultsCache::Open(const char* szPath)
+{
+	Close();
+	if (szPath == nullptr || g_Env.nResultsCacheFileSlots <= 0 || !MapFile(szPath))
+	{
+		return false;
+	}
+	if (IsCurrentFileLayout(m_pFile))
+	{
+		return true;
+	}
+	Close();
+
+	// A file from another layout, or a new one, is replaced by an empty one instead of being cleared in place, other processes may have it
+	// mapped. The new file is built under a name of its own and moved over the old one once it's complete.
+	const std::string sPath = szPath;
+#if defined(_WIN32)
+	const std::string sTempPath = sPath + "." + std::to_string(GetCurrentProcessId()) + ".tmp";
+#else
+	const std::string sTempPath = sPath + "." + std::to_string(getpid()) + ".tmp";
+#endif // defined(_WIN32)
+	remove(sTempPath.c_str());
+	if (!MapFile(sTempPath.c_str()))
+	{
+		remove(sTempPath.c_str());
+		return false;
+	}
+
+	SResultsCacheFileHeader& header = *reinterpret_cast<SResultsCacheFileHeader*>(m_pFile);
+	header.nMagic = s_nResultsCacheMagic;
+	header.nFormat = s_nResultsCacheFormat;
+	header.nNumParams = static_cast<uint32_t>(GetFileParamIndex(NUM_GOALS, 0));
+	header.nNumSlots = static_cast<uint32_t>(g_Env.nResultsCacheFileSlots);
+	header.zSlotSize = GetFileSlotSize();
+	Close();
+
+#if defined(_WIN32)
+	const bool bRenamed = (MoveFileExA(sTempPath.c_str(), sPath.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE);
+#else
+	const bool bRenamed = (rename(sTempPath.c_str(), sPath.c_str()) == 0);
+#endif // defined(_WIN32)
+	if (!bRenamed)
+	{
+		printf("Failed to replace results cache file: %s\n", szPath);
+		remove(sTempPath.c_str());
+		return false;
+	}
+
+	// Another process may have replaced it again in between, with the same layout
+	if (!MapFile(szPath))
+	{
+		return false;
+	}
+	if (!IsCurrentFileLayout(m_pFile))
+	{
+		printf("Results cache file was replaced with another layout: %s\n", szPath);
+		Close();
+		return false;
+	}
+	return true;
+}
+
+// Opens the file, creating it or growing it with zeroes if it's smaller than the cache, and maps it
+bool CResultsCache::MapFile(const char* szPath)
+{
+	const size_t zFileSize = sizeof(SResultsCacheFileHeader) + g_Env.nResultsCacheFileSlots * GetFileSlotSize();
+
+#if defined(_WIN32)
+	HANDLE hFile = CreateFileA(szPath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		printf("Failed to open results cache file: %s\n", szPath);
+		return false;
+	}
+	m_hFile = hFile;
+
+	HANDLE hMapping = CreateFileMappingA(hFile, nullptr, PAGE_READWRITE, static_cast<DWORD>(static_cast<uint64_t>(zFileSize) >> 32), static_cast<DWORD>(zFileSize), nullptr);
+	if (hMapping == nullptr)
+	{
+		printf("Failed to map results cache file: %s\n", szPath);
+		Close();
+		return false;
+	}
+	m_hMapping = hMapping;
+
+	m_pFile = static_cast<unsigned char*>(MapViewOfFile(hMapping, FILE_MAP_ALL_ACCESS, 0, 0, zFileSize));
+#else
+	m_nFile = open(szPath, O_RDWR | O_CREAT, 0644);
+	struct stat fileStat;
+	if (m_nFile < 0 || fstat(m_nFile, &fileStat) != 0 || (static_cast<size_t>(fileStat.st_size) < zFileSize && ftruncate(m_nFile, static_cast<off_t>(zFileSize)) != 0))
+	{
+		printf("Failed to open results cache file: %s\n", szPath);
+		Close();
+		return false;
+	}
+
+	void* pFile = mmap(nullptr, zFileSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_nFile, 0);
+	m_pFile = (pFile != MAP_FAILED) ? static_cast<unsigned char*>(pFile) : nullptr;
+#endif // defined(_WIN32)
+	if (m_pFile == nullptr)
+	{
+		printf("Failed to map results cache file: %s\n", szPath);
+		Close();
+		return false;
+	}
+	m_zFileSize = zFileSize;
+	return true;
+}
+
+void CResultsCache::Close()
+{
+#if defined(_WIN32)
+	if (m_pFile != nullptr)
+	{
+		UnmapViewOfFile(m_pFile);
+	}
+	if (m_hMapping != nullptr)
+	{
+		CloseHandle(m_hMapping);
+	}
+	if (m_hFile != nullptr)
+	{
+		CloseHandle(m_hFile);
+	}
+#else
+	if (m_pFile != nullptr)
+	{
+		munmap(m_pFile, m_zFileSize);
+	}
+	if (m_nFile >= 0)
+	{
+		close(m_nFile);
+	}
+#endif // defined(_WIN32)
+
+	m_pFile = nullptr;
+	m_zFileSize = 0;
+	m_hFile = nullptr;
+	m_hMapping = nullptr;
+	m_nFile = -1;
+}
+
+bool CResultsCache::Lookup(STargetSolve& targetSolve, EGoal eGoal, int nGoalParam, const std::vector<int>& vVersions)
+{
+	SResultsCacheKey key;
+	key.nTargetID = targetSolve.nTargetID;
+	key.nInterestLevel = targetSolve.nInterestLevel;
+	key.nFavor = targetSolve.nFavor;
+
+	for (int nVersion : vVersions)
+	{
+		key.nVersion = nVersion;
+		if (LookupFile(key, eGoal, nGoalParam, targetSolve.bestCombinations.aBestCombinations[eGoal][nGoalParam]))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void CResultsCache::Insert(const STargetSolve& targetSolve, int nVersion)
+{
+	SResultsCacheKey key;
+	key.nTargetID = targetSolve.nTargetID;
+	key.nInterestLevel = targetSolve.nInterestLevel;
+	key.nFavor = targetSolve.nFavor;
+	key.nVersion = nVersion;
+
+	// Lookups never take provisional results, but the results they replaced in the database mustn't be served either
+	InsertFile(key, targetSolve.bProvisional ? nullptr : &targetSolve.bestCombinations);
+}
+
+bool CResultsCache::LookupFile(const SResultsCacheKey& key, EGoal eGoal, int nGoalParam, SBestCombinations::SBestCombination& best) const
+{
+	if (m_pFile == nullptr)
+	{
+		return false;
+	}
+
+	const int nFirstSlot = GetFirstFileSlot(key);
+	for (int nProbe = 0 ; nProbe < g_Env.nResultsCacheFileProbes ; ++nProbe)
+	{
+		SResultsCacheFileSlot* pSlot = GetFileSlot(m_pFile, (nFirstSlot + nProbe) % g_Env.nResultsCacheFileSlots);
+		const uint32_t nSequence = pSlot->nSequence.load(std::memory_order_acquire);
+		if (nSequence == 0 || (nSequence & 1) != 0 || !IsFileSlotKey(*pSlot, key))
+		{
+			continue;
+		}
+
+		const SResultsCacheFileParam param = GetFileParams(pSlot)[GetFileParamIndex(eGoal, nGoalParam)];
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (pSlot->nSequence.load(std::memory_order_relaxed) != nSequence || param.nNumKnowledge == 0 || param.nNumKnowledge > MAX_CONSTELLATION_SLOTS)
+		{
+			return false;
+		}
+
+		best.fStrictEV = param.fStrictEV;
+		best.fSuccessPercentage = param.fSuccessPercentage;
+		best.vKnowledge.assign(param.aKnowledge, param.aKnowledge + param.nNumKnowledge);
+		return true;
+	}
+	return false;
+}
+
+// Replaces everything cached for the key's target state. A slot the state is cached in is reused, otherwise a never used slot, otherwise
+// the first one probed. Any other slots of the state are emptied, and without best combinations the state is only dropped.
+void CResultsCache::InsertFile(const SResultsCacheKey& key, const SBestCombinations* pBestCombinations)
+{
+	if (m_pFile == nullptr)
+	{
+		return;
+	}
+
+	const int nFirstSlot = GetFirstFileSlot(key);
+	SResultsCacheFileSlot* pSlot = nullptr;
+	SResultsCacheFileSlot* pUnusedSlot = nullptr;
+	for (int nProbe = 0 ; nProbe < g_Env.nResultsCacheFileProbes ; ++nProbe)
+	{
+		SResultsCacheFileSlot* pProbeSlot = GetFileSlot(m_pFile, (nFirstSlot + nProbe) % g_Env.nResultsCacheFileSlots);
+		if (IsFileSlotState(*pProbeSlot, key))
+		{
+			if (pBestCombinations != nullptr && pSlot == nullptr)
+			{
+				pSlot = pProbeSlot;
+			}
+			else
+			{
+				WriteFileSlot(pProbeSlot, SResultsCacheKey(), nullptr);
+			}
+		}
+		else if (pUnusedSlot == nullptr && pProbeSlot->nSequence.load(std::memory_order_acquire) == 0)
+		{
+			pUnusedSlot = pProbeSlot;
+		}
+	}
+
+	if (pBestCombinations == nullptr)
+	{
+		return;
+	}
+	if (pSlot == nullptr)
+	{
+		pSlot = (pUnusedSlot != nullptr) ? pUnusedSlot : GetFileSlot(m_pFile, nFirstSlot);
+	}
+	WriteFileSlot(pSlot, key, pBestCombinations);
+}
+
+// Writes every goal param of the key to the slot, or empties it for a key of no target state and no best combinations.
+// A slot another writer is busy with is left alone.
+void CResultsCache::WriteFileSlot(SResultsCacheFileSlot* pSlot, const SResultsCacheKey& key, const SBestCombinations* pBestCombinations)
+{
+	// The time is stamped before the slot is taken, so a slot that's odd with an old time was left by a writer that died. Taking it over
+	// keeps it odd with a new sequence number, and whatever the dead writer left in it is cleared out.
+	const int64_t nTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	uint32_t nSequence = pSlot->nSequence.load(std::memory_order_acquire);
+	bool bTakenOver = false;
+	if ((nSequence & 1) != 0)
+	{
+		if (nTime - pSlot->nWriteTime.load(std::memory_order_relaxed) < s_nStaleWriteMilliseconds)
+		{
+			return;
+		}
+		pSlot->nWriteTime.store(nTime, std::memory_order_relaxed);
+		if (!pSlot->nSequence.compare_exchange_strong(nSequence, nSequence + 2, std::memory_order_acq_rel))
+		{
+			return;
+		}
+		nSequence += 1;
+		bTakenOver = true;
+	}
+	else
+	{
+		pSlot->nWriteTime.store(nTime, std::memory_order_relaxed);
+		if (!pSlot->nSequence.compare_exchange_strong(nSequence, nSequence + 1, std::memory_order_acq_rel))
+		{
+			return;
+		}
+	}
+
+	SResultsCacheFileParam* pParams = GetFileParams(pSlot);
+	const int nNumParams = GetFileParamIndex(NUM_GOALS, 0);
+	if (pSlot->nTargetID != key.nTargetID || pSlot->nInterestLevel != key.nInterestLevel || pSlot->nFavor != key.nFavor || pSlot->nVersion != key.nVersion ||
+		nSequence == 0 || bTakenOver || pBestCombinations == nullptr)
+	{
+		for (int nParam = 0 ; nParam < nNumParams ; ++nParam)
+		{
+			pParams[nParam].nNumKnowledge = 0;
+		}
+		pSlot->nTargetID = key.nTargetID;
+		pSlot->nInterestLevel = key.nInterestLevel;
+		pSlot->nFavor = key.nFavor;
+		pSlot->nVersion = key.nVersion;
+	}
+
+	for (int nGoal = 0 ; nGoal < NUM_GOALS && pBestCombinations != nullptr ; ++nGoal)
+	{
+		const auto& vBest = pBestCombinations->aBestCombinations[nGoal];
+		const int nNumGoalParams = static_cast<int>(vBest.size());
+		for (int nParam = 0 ; nParam < nNumGoalParams ; ++nParam)
+		{
+			if (vBest[nParam].vKnowledge.size() > MAX_CONSTELLATION_SLOTS)
+			{
+				continue;
+			}
+
+			const SBestCombinations::SBestCombination& best = vBest[nParam];
+			SResultsCacheFileParam& param = pParams[GetFileParamIndex(static_cast<EGoal>(nGoal), nParam)];
+			param.fStrictEV = best.fStrictEV;
+			param.fSuccessPercentage = best.fSuccessPercentage;
+			param.nNumKnowledge = static_cast<uint16_t>(best.vKnowledge.size());
+			std::copy(best.vKnowledge.begin(), best.vKnowledge.end(), param.aKnowledge);
+		}
+	}
+
+	pSlot->nSequence.store(nSequence + 2, std::memory_order_release);
+}
@@ -0,0 +1,66 @@
+#if !defined(RESULTSCACHE_H)
+#define RESULTSCACHE_H
+
+#include <tuple>
+#include <vector>
+
+#include "Types.h"
+
+// Stored results of a target state, keyed by the results version they were stored with, so one solver's results never stand in for another's
+struct SResultsCacheKey
+{
+	int nTargetID = -1;
+	int nInterestLevel = 0;
+	int nFavor = 0;
+	int nVersion = 0;
+
+	bool operator<(const SResultsCacheKey& rhs) const
+	{
+		return std::tie(nTargetID, nInterestLevel, nFavor, nVersion) < std::tie(rhs.nTargetID, rhs.nInterestLevel, rhs.nFavor, rhs.nVersion);
+	}
+	bool operator==(const SResultsCacheKey& rhs) const
+	{
+		return !(*this < rhs) && !(rhs < *this);
+	}
+};
+
+struct SResultsCacheFileSlot;
+
+// Cache in front of the results table, a memory mapped file that outlives the process, so a repeat lookup needs neither a database connection
+// nor a query. Goal params without a best combination haven't been cached, like rows missing from the results table.
+// It holds the results of a target state as last stored or fetched by a solver process. Results deleted or changed in the database by
+// anything else are still served from it until the cache file is deleted.
+// The file is shared by every process using it. Each slot is guarded by a sequence number, so a reader never sees a half written slot
+// and a writer that finds a slot busy just doesn't cache. A slot left busy by a writer that died is taken over by the next writer.
+class CResultsCache
+{
+public:
+	CResultsCache() {}
+	~CResultsCache();
+	CResultsCache(const CResultsCache&) = delete;
+	CResultsCache& operator=(const CResultsCache&) = delete;
+
+	// Maps the cache file, creating or replacing it if it's missing or laid out differently. Without it nothing is cached.
+	bool Open(const char* szPath);
+	void Close();
+
+	// Fills in the goal param's best combination from results stored with the first of vVersions that's cached
+	bool Lookup(STargetSolve& targetSolve, EGoal eGoal, int nGoalParam, const std::vector<int>& vVersions);
+	// Caches every goal param of results stored with nVersion, in place of whatever was cached for the target state.
+	// Provisional results aren't cached, the target state is only dropped.
+	void Insert(const STargetSolve& targetSolve, int nVersion);
+
+private:
+	bool MapFile(const char* szPath);
+	bool LookupFile(const SResultsCacheKey& key, EGoal eGoal, int nGoalParam, SBestCombinations::SBestCombination& best) const;
+	void InsertFile(const SResultsCacheKey& key, const SBestCombinations* pBestCombinations);
+	void WriteFileSlot(SResultsCacheFileSlot* pSlot, const SResultsCacheKey& key, const SBestCombinations* pBestCombinations);
+
+	unsigned char* m_pFile = nullptr;
+	size_t m_zFileSize = 0;
+	void* m_hFile = nullptr;
+	void* m_hMapping = nullptr;
+	int m_nFile = -1;
+};
+
+#endif // !defined(RESULTSCACHE_H)
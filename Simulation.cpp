@@ -1,6 +1,24 @@
 #include "Simulation.h"
 
 #include <ctime>
+#include <climits>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <array>
+#include <tuple>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+#include <cstdio>
+#include <utility>
+
+#if defined(_WIN32)
+#define _WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#undef min
+#undef max
+#endif // defined(_WIN32)
 
 #include "Utils.h"
 
@@ -106,60 +124,224 @@ static void AccumulateEV(double& fStrictEV, double& fSuccess, const SSimulationS
 	}
 }
 
-static void SimulateHelper(SCombinationResult& result, SSimulationStatus& status, const SConstellation& constellation, const std::vector<SKnowledge>& vSlots, int nSlot)
+// The statistic each goal's params are thresholds on
+template <EGoal eGoal>
+int GetGoalStatistic(const SSimulationStatusFinal& status);
+
+template <>
+int GetGoalStatistic<GOAL_SPARK>(const SSimulationStatusFinal& status) { return status.nSpark; }
+template <>
+int GetGoalStatistic<GOAL_SPARK_FAILURE>(const SSimulationStatusFinal& status) { return status.nSparkFailure; }
+template <>
+int GetGoalStatistic<GOAL_CONSECUTIVE_SPARK>(const SSimulationStatusFinal& status) { return status.nMaxConsecutiveSpark; }
+template <>
+int GetGoalStatistic<GOAL_CONSECUTIVE_SPARK_FAILURE>(const SSimulationStatusFinal& status) { return status.nMaxConsecutiveSparkFailure; }
+template <>
+int GetGoalStatistic<GOAL_ACCUMULATED_FAVOR>(const SSimulationStatusFinal& status) { return status.nAccumulatedFavor; }
+template <>
+int GetGoalStatistic<GOAL_MAX_FAVOR>(const SSimulationStatusFinal& status) { return status.nMaxFavor; }
+template <>
+int GetGoalStatistic<GOAL_FREE_TALK>(const SSimulationStatusFinal&) { return 0; }
+
+// Every goal param at or below the statistic succeeds, so one bin per goal stands in for testing each param
+template <EGoal eGoal>
+void AccumulateHistogram(SCombinationResult& result, const SSimulationStatusFinal& status)
+{
+	const int nStatistic = GetGoalStatistic<eGoal>(status);
+	if (nStatistic < 0)
+	{
+		return;
+	}
+
+	auto& histogram = result.aGoalHistograms[eGoal];
+	const int nBin = std::min(nStatistic, static_cast<int>(histogram.vChance.size()) - 1);
+	histogram.vChance[nBin] += status.fChance;
+	histogram.vModifiedAccumulatedFavor[nBin] += status.fModifiedAccumulatedFavor;
+}
+
+static void AccumulateResult(SCombinationResult& result, const SSimulationStatusFinal& status)
 {
-	if (nSlot >= constellation.vSlotOrder.size())
+	if (g_Env.eGoalAccumulation == GOAL_ACCUMULATION_HISTOGRAM)
 	{
-		// Less branches, faster
+		AccumulateHistogram<GOAL_SPARK>(result, status);
+		AccumulateHistogram<GOAL_SPARK_FAILURE>(result, status);
+		AccumulateHistogram<GOAL_CONSECUTIVE_SPARK>(result, status);
+		AccumulateHistogram<GOAL_CONSECUTIVE_SPARK_FAILURE>(result, status);
+		AccumulateHistogram<GOAL_ACCUMULATED_FAVOR>(result, status);
+		AccumulateHistogram<GOAL_MAX_FAVOR>(result, status);
+		AccumulateHistogram<GOAL_FREE_TALK>(result, status);
+		return;
+	}
+
+	// Less branches, faster
 #define THING(eGoal) \
+	{ \
+		auto& aBest = result.bestCombinationStats.aBestCombinations[eGoal]; \
+		const int nNumGoalParams = static_cast<int>(aBest.size()); \
+		for (int nGoalParam = 0 ; nGoalParam < nNumGoalParams ; ++nGoalParam) \
 		{ \
-			auto& aBest = result.bestCombinationStats.aBestCombinations[eGoal]; \
-			const int nNumGoalParams = static_cast<int>(aBest.size()); \
-			for (int nGoalParam = 0 ; nGoalParam < nNumGoalParams ; ++nGoalParam) \
-			{ \
-				auto& best = aBest[nGoalParam]; \
-				AccumulateEV<eGoal>(best.fStrictEV, best.fSuccessPercentage, status, nGoalParam); \
-			} \
-		}
-			
-		THING(GOAL_SPARK);
-		THING(GOAL_SPARK_FAILURE);
-		THING(GOAL_CONSECUTIVE_SPARK);
-		THING(GOAL_CONSECUTIVE_SPARK_FAILURE);
-		THING(GOAL_ACCUMULATED_FAVOR);
-		THING(GOAL_MAX_FAVOR);
-		THING(GOAL_FREE_TALK);
+			auto& best = aBest[nGoalParam]; \
+			AccumulateEV<eGoal>(best.fStrictEV, best.fSuccessPercentage, status, nGoalParam); \
+		} \
+	}
+		
+	THING(GOAL_SPARK);
+	THING(GOAL_SPARK_FAILURE);
+	THING(GOAL_CONSECUTIVE_SPARK);
+	THING(GOAL_CONSECUTIVE_SPARK_FAILURE);
+	THING(GOAL_ACCUMULATED_FAVOR);
+	THING(GOAL_MAX_FAVOR);
+	THING(GOAL_FREE_TALK);
 #undef THING
-			
-		// More branches, slower
-		/*for (int nGoal = 0 ; nGoal < NUM_GOALS ; ++nGoal)
+		
+	// More branches, slower
+	/*for (int nGoal = 0 ; nGoal < NUM_GOALS ; ++nGoal)
+	{
+		const EGoal eGoal = static_cast<EGoal>(nGoal);
+
+		auto& vBest = result.bestCombinationStats.aBestCombinations[nGoal];
+		const int nNumGoalParams = static_cast<int>(vBest.size());
+		for (int nGoalParam = 0 ; nGoalParam < nNumGoalParams ; ++nGoalParam)
 		{
-			const EGoal eGoal = static_cast<EGoal>(nGoal);
+			auto& best = vBest[nGoalParam];
 
-			auto& vBest = result.bestCombinationStats.aBestCombinations[nGoal];
-			const int nNumGoalParams = static_cast<int>(vBest.size());
-			for (int nGoalParam = 0 ; nGoalParam < nNumGoalParams ; ++nGoalParam)
-			{
-				auto& best = vBest[nGoalParam];
+			AccumulateEV(best.fStrictEV, best.fSuccessPercentage, status, eGoal, nGoalParam);
+		}
+	}*/
+}
 
-				AccumulateEV(best.fStrictEV, best.fSuccessPercentage, status, eGoal, nGoalParam);
-			}
-		}*/
+// Turns a goal's histogram into goal param results, a goal param's result is the sum of every bin at or above it
+static void FinalizeGoalResult(SCombinationResult& result, EGoal eGoal)
+{
+	if (g_Env.eGoalAccumulation != GOAL_ACCUMULATION_HISTOGRAM)
+	{
 		return;
 	}
 
-	const SKnowledge& knowledge = vSlots[constellation.vSlotOrder[nSlot]];
+	auto& vBest = result.bestCombinationStats.aBestCombinations[eGoal];
+	const auto& histogram = result.aGoalHistograms[eGoal];
+
+	double fSuccess = 0.0;
+	double fStrictEV = 0.0;
+	for (int nGoalParam = static_cast<int>(vBest.size()) - 1 ; nGoalParam >= 0 ; --nGoalParam)
+	{
+		fSuccess += histogram.vChance[nGoalParam];
+		fStrictEV += histogram.vModifiedAccumulatedFavor[nGoalParam];
+		vBest[nGoalParam].fSuccessPercentage = fSuccess;
+		vBest[nGoalParam].fStrictEV = fStrictEV;
+	}
+}
+
+// Must be called once every path of a permutation has been accumulated
+static void FinalizeResult(SCombinationResult& result)
+{
+	for (int nGoal = 0 ; nGoal < NUM_GOALS ; ++nGoal)
+	{
+		FinalizeGoalResult(result, static_cast<EGoal>(nGoal));
+	}
+}
+
+// The knowledge fields the simulation reads, one flat array per field indexed by dense knowledge index.
+// Built once per solve so the hot paths work on indices and never look up or copy SKnowledge.
+struct SKnowledgeTable
+{
+	// Indices follow knowledge ID order, so combinations of indices come out in the same order as combinations of IDs
+	bool Build(const SKnowledgeCategory& category)
+	{
+		std::vector<TKnowledgeID> vSortedKnowledge = category.vKnowledge;
+		std::sort(vSortedKnowledge.begin(), vSortedKnowledge.end());
+
+		const int nNumKnowledge = static_cast<int>(vSortedKnowledge.size());
+		vIDs.resize(nNumKnowledge);
+		vInterest.resize(nNumKnowledge);
+		vAverageFavor.resize(nNumKnowledge);
+		vComboDelay.resize(nNumKnowledge);
+		vComboLength.resize(nNumKnowledge);
+		vComboInterest.resize(nNumKnowledge);
+		vComboFavor.resize(nNumKnowledge);
+		vIndices.assign(nNumKnowledge > 0 ? vSortedKnowledge.back() + 1 : 0, -1);
+
+		for (int nKnowledge = 0 ; nKnowledge < nNumKnowledge ; ++nKnowledge)
+		{
+			const TKnowledgeID nKnowledgeID = vSortedKnowledge[nKnowledge];
+			auto itKnowledge = g_Env.mapKnowledges.find(nKnowledgeID);
+			if (itKnowledge == g_Env.mapKnowledges.end())
+			{
+				printf("Failed to find knowledge: %d\n", nKnowledgeID);
+				return false;
+			}
+			const SKnowledge& knowledge = itKnowledge->second;
+
+			vIDs[nKnowledge] = nKnowledgeID;
+			vInterest[nKnowledge] = knowledge.fInterest;
+			vAverageFavor[nKnowledge] = knowledge.nAverageFavor;
+			vComboDelay[nKnowledge] = knowledge.comboEffect.nDelay;
+			vComboLength[nKnowledge] = knowledge.comboEffect.nLength;
+			vComboInterest[nKnowledge] = knowledge.comboEffect.nInterest;
+			vComboFavor[nKnowledge] = knowledge.comboEffect.nFavor;
+			if (vIndices[nKnowledgeID] < 0)
+			{
+				vIndices[nKnowledgeID] = nKnowledge;
+			}
+		}
+		return true;
+	}
+
+	int GetNumKnowledge() const { return static_cast<int>(vIDs.size()); }
+	int GetIndex(TKnowledgeID nKnowledgeID) const { return (nKnowledgeID < vIndices.size()) ? vIndices[nKnowledgeID] : -1; }
+
+	SComboEffect GetComboEffect(int nKnowledge) const
+	{
+		SComboEffect comboEffect;
+		comboEffect.nDelay = vComboDelay[nKnowledge];
+		comboEffect.nLength = vComboLength[nKnowledge];
+		comboEffect.nInterest = vComboInterest[nKnowledge];
+		comboEffect.nFavor = vComboFavor[nKnowledge];
+		return comboEffect;
+	}
+
+	std::vector<TKnowledgeID> vIDs;
+	std::vector<double> vInterest;
+	std::vector<int> vAverageFavor;
+	std::vector<int> vComboDelay;
+	std::vector<int> vComboLength;
+	std::vector<int> vComboInterest;
+	std::vector<int> vComboFavor;
+
+	// Knowledge ID to index, -1 for knowledge outside the category
+	std::vector<int> vIndices;
+};
+
+// Target state while a permutation is played slot by slot
+struct STimelineCursor
+{
+	STimelineCursor() {}
+	STimelineCursor(int nTargetInterestLevel, int nTargetFavor)
+	: fTargetInterestLevel(static_cast<double>(nTargetInterestLevel))
+	, nTargetFavor(nTargetFavor)
+	{
+	}
+
+	std::array<SComboEffect, MAX_CONSTELLATION_SLOTS> aComboEffects;
+	int nNumComboEffects = 0;
+	double fTargetInterestLevel = 0.0;
+	int nTargetFavor = 0;
+};
 
+// Plays the knowledge in the given slot, filling in that slot of the timeline
+static void AdvanceTimeline(SSimulationTimeline& timeline, STimelineCursor& cursor, int nSlot, const SKnowledgeTable& knowledgeTable, int nKnowledge)
+{
 	// Deal with current combo effects
-	for (SComboEffect& comboEffect : status.vComboEffects)
+	for (int nComboEffect = 0 ; nComboEffect < cursor.nNumComboEffects ; ++nComboEffect)
 	{
+		SComboEffect& comboEffect = cursor.aComboEffects[nComboEffect];
 		if (comboEffect.nDelay > 0)
 		{
 			--comboEffect.nDelay;
 			if (comboEffect.nDelay <= 0)
 			{
-				status.fTargetInterestLevel -= comboEffect.nInterest;
-				status.nTargetFavor -= comboEffect.nFavor;
+				cursor.fTargetInterestLevel -= comboEffect.nInterest;
+				cursor.nTargetFavor -= comboEffect.nFavor;
 			}
 		}
 		else if (comboEffect.nLength > 0)
@@ -167,88 +349,1871 @@ static void SimulateHelper(SCombinationResult& result, SSimulationStatus& status
 			--comboEffect.nLength;
 			if (comboEffect.nLength <= 0)
 			{
-				status.fTargetInterestLevel += comboEffect.nInterest;
-				status.nTargetFavor += comboEffect.nFavor;
+				cursor.fTargetInterestLevel += comboEffect.nInterest;
+				cursor.nTargetFavor += comboEffect.nFavor;
 			}
 		}
 	}
 
 	// Apply new combo effects
-	if (knowledge.comboEffect.nLength > 0)
+	if (knowledgeTable.vComboLength[nKnowledge] > 0)
+	{
+		cursor.aComboEffects[cursor.nNumComboEffects++] = knowledgeTable.GetComboEffect(nKnowledge);
+	}
+
+	timeline.aTargetInterestLevel[nSlot] = cursor.fTargetInterestLevel;
+	timeline.aTargetFavor[nSlot] = cursor.nTargetFavor;
+	timeline.aSparkChance[nSlot] = std::min(knowledgeTable.vInterest[nKnowledge] / std::max(cursor.fTargetInterestLevel, DBL_EPSILON), 1.0);
+	timeline.aFavorGain[nSlot] = std::max(1, knowledgeTable.vAverageFavor[nKnowledge] - cursor.nTargetFavor);
+}
+
+// Combo effects tick once per slot whatever the spark outcome, so the target's interest and favor at every slot are fixed for a permutation.
+// Resolving them once up front leaves only the counters to the branch walk.
+static void BuildTimeline(SSimulationTimeline& timeline, int nTargetInterestLevel, int nTargetFavor, const SConstellation& constellation, const SKnowledgeTable& knowledgeTable, const int* pSlots)
+{
+	STimelineCursor cursor(nTargetInterestLevel, nTargetFavor);
+
+	timeline.nNumSlots = static_cast<int>(constellation.vSlotOrder.size());
+	for (int nSlot = 0 ; nSlot < timeline.nNumSlots ; ++nSlot)
+	{
+		AdvanceTimeline(timeline, cursor, nSlot, knowledgeTable, pSlots[constellation.vSlotOrder[nSlot]]);
+	}
+}
+
+static void ApplySpark(SSimulationStatus& status, int nFavorGain, double fSparkChance)
+{
+	status.nCurrentMaxFavor += nFavorGain;
+	status.nAccumulatedFavor += status.nCurrentMaxFavor;
+	++status.nSpark;
+	if (status.nCurrentMaxFavor > status.nMaxMaxFavor)
+	{
+		status.nMaxMaxFavor = status.nCurrentMaxFavor;
+	}
+
+	++status.nCurrentConsecutiveSpark;
+	status.nCurrentConsecutiveSparkFailure = 0;
+	if (status.nCurrentConsecutiveSpark > status.nMaxConsecutiveSpark)
+	{
+		status.nMaxConsecutiveSpark = status.nCurrentConsecutiveSpark;
+	}
+
+	status.fChance *= fSparkChance;
+}
+
+static void ApplySparkFailure(SSimulationStatus& status, double fSparkChance)
+{
+	status.nCurrentMaxFavor = 0;
+	++status.nSparkFailure;
+
+	++status.nCurrentConsecutiveSparkFailure;
+	status.nCurrentConsecutiveSpark = 0;
+	if (status.nCurrentConsecutiveSparkFailure > status.nMaxConsecutiveSparkFailure)
 	{
-		status.vComboEffects.push_back(knowledge.comboEffect);
+		status.nMaxConsecutiveSparkFailure = status.nCurrentConsecutiveSparkFailure;
 	}
 
-	const double fSparkChance = std::min(knowledge.fInterest / std::max(status.fTargetInterestLevel, DBL_EPSILON), 1.0);
+	status.fChance *= (1.0f - fSparkChance);
+}
 
-	// Spark
+// Depth first walk over every spark/failure path, using an explicit stack so no path ever touches the allocator
+static void SimulateHelper(SCombinationResult& result, const SSimulationTimeline& timeline)
+{
+	struct SPendingPath
 	{
-		SSimulationStatus newStatus = status;
+		SSimulationStatus status;
+		int nSlot = 0;
+	};
 
-		const int nInterestGain = std::max(1, knowledge.nAverageFavor - newStatus.nTargetFavor);
+	// At most one pending failure path per slot plus the path being walked
+	std::array<SPendingPath, MAX_CONSTELLATION_SLOTS + 1> aStack;
+	int nStackSize = 0;
 
-		newStatus.nCurrentMaxFavor += nInterestGain;
-		newStatus.nAccumulatedFavor += newStatus.nCurrentMaxFavor;
-		++newStatus.nSpark;
-		if (newStatus.nCurrentMaxFavor > newStatus.nMaxMaxFavor)
+	aStack[nStackSize++] = {SSimulationStatus(), 0};
+	while (nStackSize > 0)
+	{
+		const SPendingPath path = aStack[--nStackSize];
+		if (path.nSlot >= timeline.nNumSlots)
 		{
-			newStatus.nMaxMaxFavor = newStatus.nCurrentMaxFavor;
+			AccumulateResult(result, path.status);
+			continue;
 		}
 
-		++newStatus.nCurrentConsecutiveSpark;
-		newStatus.nCurrentConsecutiveSparkFailure = 0;
-		if (newStatus.nCurrentConsecutiveSpark > newStatus.nMaxConsecutiveSpark)
+		const double fSparkChance = timeline.aSparkChance[path.nSlot];
+
+		// Spark failure is pushed first so the spark path is walked first, same order as the old recursion
+		if (fSparkChance < 1.0f)
 		{
-			newStatus.nMaxConsecutiveSpark = newStatus.nCurrentConsecutiveSpark;
+			SPendingPath& failurePath = aStack[nStackSize++];
+			failurePath.status = path.status;
+			failurePath.nSlot = path.nSlot + 1;
+			ApplySparkFailure(failurePath.status, fSparkChance);
 		}
 
-		newStatus.fChance *= fSparkChance;
-		SimulateHelper(result, newStatus, constellation, vSlots, nSlot + 1);
+		// Spark
+		{
+			SPendingPath& sparkPath = aStack[nStackSize++];
+			sparkPath.status = path.status;
+			sparkPath.nSlot = path.nSlot + 1;
+			ApplySpark(sparkPath.status, timeline.aFavorGain[path.nSlot], fSparkChance);
+		}
 	}
+}
 
-	if (fSparkChance >= 1.0f)
+// Same walk as SimulateHelper with the slot count known at compile time. The recursion unrolls into one function per slot,
+// and each branch's status is a local copied from its parent's, so it can stay in registers instead of going through the explicit stack.
+template <int nRemainingSlots>
+static void SimulateFixedSlots(SCombinationResult& result, const double* pSparkChance, const int* pFavorGain, const SSimulationStatus& status)
+{
+	const double fSparkChance = *pSparkChance;
+
+	// Spark first, same order as SimulateHelper
+	SSimulationStatus sparkStatus = status;
+	ApplySpark(sparkStatus, *pFavorGain, fSparkChance);
+	SimulateFixedSlots<nRemainingSlots - 1>(result, pSparkChance + 1, pFavorGain + 1, sparkStatus);
+
+	if (fSparkChance < 1.0f)
 	{
-		return;
+		SSimulationStatus failureStatus = status;
+		ApplySparkFailure(failureStatus, fSparkChance);
+		SimulateFixedSlots<nRemainingSlots - 1>(result, pSparkChance + 1, pFavorGain + 1, failureStatus);
 	}
+}
+
+template <>
+void SimulateFixedSlots<0>(SCombinationResult& result, const double*, const int*, const SSimulationStatus& status)
+{
+	AccumulateResult(result, status);
+}
+
+template <int nNumSlots>
+static void SimulateFixed(SCombinationResult& result, const SSimulationTimeline& timeline)
+{
+	SimulateFixedSlots<nNumSlots>(result, timeline.aSparkChance.data(), timeline.aFavorGain.data(), SSimulationStatus());
+}
+
+typedef void (*TSimulateFixed)(SCombinationResult& result, const SSimulationTimeline& timeline);
+
+template <size_t... nNumSlots>
+static const std::array<TSimulateFixed, sizeof...(nNumSlots)>& GetSimulateFixedKernels(std::index_sequence<nNumSlots...>)
+{
+	static const std::array<TSimulateFixed, sizeof...(nNumSlots)> aKernels = {{ &SimulateFixed<static_cast<int>(nNumSlots)>... }};
+	return aKernels;
+}
 
-	// Spark failure
+// Picks the kernel built for the timeline's slot count, one is instantiated for every count a constellation can have
+static void SimulateTree(SCombinationResult& result, const SSimulationTimeline& timeline)
+{
+	const auto& aKernels = GetSimulateFixedKernels(std::make_index_sequence<MAX_CONSTELLATION_SLOTS + 1>());
+	if (timeline.nNumSlots < 0 || timeline.nNumSlots >= static_cast<int>(aKernels.size()))
 	{
-		SSimulationStatus newStatus = status;
+		SimulateHelper(result, timeline);
+		return;
+	}
+	aKernels[timeline.nNumSlots](result, timeline);
+}
 
-		newStatus.nCurrentMaxFavor = 0;
-		++newStatus.nSparkFailure;
+// Permutations simulated in lockstep by SimulateBatch. The lanes are plain fixed size loops the compiler vectorizes.
+const int SIMULATION_BATCH_LANES = 8;
+
+// Timelines of up to SIMULATION_BATCH_LANES permutations of the same length, one lane each. Only the slots from nFirstSlot on are filled in,
+// a batch can pick up permutations that share the earlier slots part way through.
+struct SSimulationBatch
+{
+	// Unused lanes always spark and are never accumulated
+	void Clear(int nNumSlots, int nFirstSlot = 0)
+	{
+		this->nNumLanes = 0;
+		this->nNumSlots = nNumSlots;
+		for (int nSlot = nFirstSlot ; nSlot < nNumSlots ; ++nSlot)
+		{
+			aSparkChance[nSlot].fill(1.0);
+			aFailureChance[nSlot].fill(0.0);
+			aFavorGain[nSlot].fill(1);
+			aSparkLanes[nSlot] = 0;
+			aFailureLanes[nSlot] = 0;
+		}
+	}
 
-		++newStatus.nCurrentConsecutiveSparkFailure;
-		newStatus.nCurrentConsecutiveSpark = 0;
-		if (newStatus.nCurrentConsecutiveSparkFailure > newStatus.nMaxConsecutiveSparkFailure)
+	void AddLane(const SSimulationTimeline& timeline, int nFirstSlot = 0)
+	{
+		const int nLane = nNumLanes++;
+		for (int nSlot = nFirstSlot ; nSlot < nNumSlots ; ++nSlot)
 		{
-			newStatus.nMaxConsecutiveSparkFailure = newStatus.nCurrentConsecutiveSparkFailure;
+			const double fSparkChance = timeline.aSparkChance[nSlot];
+			aSparkChance[nSlot][nLane] = fSparkChance;
+			aFailureChance[nSlot][nLane] = (1.0f - fSparkChance);
+			aFavorGain[nSlot][nLane] = timeline.aFavorGain[nSlot];
+			aSparkLanes[nSlot] |= (fSparkChance > 0.0) ? (1u << nLane) : 0u;
+			aFailureLanes[nSlot] |= (fSparkChance < 1.0f) ? (1u << nLane) : 0u;
 		}
+	}
+
+	unsigned int GetLanes() const
+	{
+		return (1u << nNumLanes) - 1;
+	}
+
+	int nNumLanes = 0;
+	int nNumSlots = 0;
+	std::array<std::array<double, SIMULATION_BATCH_LANES>, MAX_CONSTELLATION_SLOTS> aSparkChance;
+	std::array<std::array<double, SIMULATION_BATCH_LANES>, MAX_CONSTELLATION_SLOTS> aFailureChance;
+	std::array<std::array<int, SIMULATION_BATCH_LANES>, MAX_CONSTELLATION_SLOTS> aFavorGain;
+	// Masks of the lanes whose spark or failure at the slot has any chance
+	std::array<unsigned int, MAX_CONSTELLATION_SLOTS> aSparkLanes;
+	std::array<unsigned int, MAX_CONSTELLATION_SLOTS> aFailureLanes;
+};
+
+// One branch path for every lane. Spark counts and streaks only depend on the path so they're shared, chance and favor differ per lane.
+struct SBatchStatus
+{
+	SBatchStatus() = default;
+
+	// Every lane starts from the same path
+	SBatchStatus(const SSimulationStatus& status, unsigned int nLanes)
+	: nLiveLanes(nLanes)
+	, nSpark(status.nSpark)
+	, nSparkFailure(status.nSparkFailure)
+	, nCurrentConsecutiveSpark(status.nCurrentConsecutiveSpark)
+	, nMaxConsecutiveSpark(status.nMaxConsecutiveSpark)
+	, nCurrentConsecutiveSparkFailure(status.nCurrentConsecutiveSparkFailure)
+	, nMaxConsecutiveSparkFailure(status.nMaxConsecutiveSparkFailure)
+	{
+		aChance.fill(status.fChance);
+		aAccumulatedFavor.fill(status.nAccumulatedFavor);
+		aCurrentMaxFavor.fill(status.nCurrentMaxFavor);
+		aMaxMaxFavor.fill(status.nMaxMaxFavor);
+	}
+
+	std::array<double, SIMULATION_BATCH_LANES> aChance;
+	std::array<int, SIMULATION_BATCH_LANES> aAccumulatedFavor;
+	std::array<int, SIMULATION_BATCH_LANES> aCurrentMaxFavor;
+	std::array<int, SIMULATION_BATCH_LANES> aMaxMaxFavor;
+
+	// Lanes the path still has a chance for, the others are skipped when accumulating
+	unsigned int nLiveLanes = 0;
+
+	int nSpark = 0;
+	int nSparkFailure = 0;
+	int nCurrentConsecutiveSpark = 0;
+	int nMaxConsecutiveSpark = 0;
+	int nCurrentConsecutiveSparkFailure = 0;
+	int nMaxConsecutiveSparkFailure = 0;
+};
+
+// Lane-wise ApplySpark
+static void ApplyBatchSpark(SBatchStatus& status, const std::array<int, SIMULATION_BATCH_LANES>& aFavorGain, const std::array<double, SIMULATION_BATCH_LANES>& aSparkChance)
+{
+	for (int nLane = 0 ; nLane < SIMULATION_BATCH_LANES ; ++nLane)
+	{
+		status.aCurrentMaxFavor[nLane] += aFavorGain[nLane];
+		status.aAccumulatedFavor[nLane] += status.aCurrentMaxFavor[nLane];
+		status.aMaxMaxFavor[nLane] = std::max(status.aMaxMaxFavor[nLane], status.aCurrentMaxFavor[nLane]);
+		status.aChance[nLane] *= aSparkChance[nLane];
+	}
+
+	++status.nSpark;
+	++status.nCurrentConsecutiveSpark;
+	status.nCurrentConsecutiveSparkFailure = 0;
+	status.nMaxConsecutiveSpark = std::max(status.nMaxConsecutiveSpark, status.nCurrentConsecutiveSpark);
+}
 
-		newStatus.fChance *= (1.0f - fSparkChance);
-		SimulateHelper(result, newStatus, constellation, vSlots, nSlot + 1);
+// Lane-wise ApplySparkFailure, lanes that can't fail end up with no chance and add nothing when accumulated
+static void ApplyBatchSparkFailure(SBatchStatus& status, const std::array<double, SIMULATION_BATCH_LANES>& aFailureChance)
+{
+	for (int nLane = 0 ; nLane < SIMULATION_BATCH_LANES ; ++nLane)
+	{
+		status.aCurrentMaxFavor[nLane] = 0;
+		status.aChance[nLane] *= aFailureChance[nLane];
 	}
+
+	++status.nSparkFailure;
+	++status.nCurrentConsecutiveSparkFailure;
+	status.nCurrentConsecutiveSpark = 0;
+	status.nMaxConsecutiveSparkFailure = std::max(status.nMaxConsecutiveSparkFailure, status.nCurrentConsecutiveSparkFailure);
 }
 
-static void Simulate(SCombinationResult& result, int nTargetInterestLevel, int nTargetFavor, const SConstellation& constellation, const std::vector<SKnowledge>& vSlots)
+static void AccumulateBatchResults(SCombinationResult* pResults, const SSimulationBatch& batch, const SBatchStatus& batchStatus)
 {
 	SSimulationStatus status;
-	status.fTargetInterestLevel = static_cast<double>(nTargetInterestLevel);
-	status.nTargetFavor = nTargetFavor;
+	status.nSpark = batchStatus.nSpark;
+	status.nSparkFailure = batchStatus.nSparkFailure;
+	status.nMaxConsecutiveSpark = batchStatus.nMaxConsecutiveSpark;
+	status.nMaxConsecutiveSparkFailure = batchStatus.nMaxConsecutiveSparkFailure;
+	for (int nLane = 0 ; nLane < batch.nNumLanes ; ++nLane)
+	{
+		if ((batchStatus.nLiveLanes & (1u << nLane)) == 0)
+		{
+			continue;
+		}
+		status.fChance = batchStatus.aChance[nLane];
+		status.nAccumulatedFavor = batchStatus.aAccumulatedFavor[nLane];
+		status.nMaxMaxFavor = batchStatus.aMaxMaxFavor[nLane];
+		AccumulateResult(pResults[nLane], status);
+	}
+}
 
-	if (g_Env.bSafetyChecks)
+// Same walk as SimulateFixedSlots for every lane at once. A branch is walked while any lane still has a chance of taking it, lanes without one
+// drop out of the branch's live lanes. The paths a lane skips this way have no chance and add nothing, and the spark paths still come first,
+// so every lane accumulates the same sums in the same order as its own walk would.
+template <int nRemainingSlots>
+static void SimulateBatchSlots(SCombinationResult* pResults, const SSimulationBatch& batch, int nSlot, const SBatchStatus& status)
+{
+	const unsigned int nSparkLanes = (status.nLiveLanes & batch.aSparkLanes[nSlot]);
+	if (nSparkLanes != 0)
+	{
+		SBatchStatus sparkStatus = status;
+		sparkStatus.nLiveLanes = nSparkLanes;
+		ApplyBatchSpark(sparkStatus, batch.aFavorGain[nSlot], batch.aSparkChance[nSlot]);
+		SimulateBatchSlots<nRemainingSlots - 1>(pResults, batch, nSlot + 1, sparkStatus);
+	}
+
+	const unsigned int nFailureLanes = (status.nLiveLanes & batch.aFailureLanes[nSlot]);
+	if (nFailureLanes != 0)
+	{
+		SBatchStatus failureStatus = status;
+		failureStatus.nLiveLanes = nFailureLanes;
+		ApplyBatchSparkFailure(failureStatus, batch.aFailureChance[nSlot]);
+		SimulateBatchSlots<nRemainingSlots - 1>(pResults, batch, nSlot + 1, failureStatus);
+	}
+}
+
+template <>
+void SimulateBatchSlots<0>(SCombinationResult* pResults, const SSimulationBatch& batch, int, const SBatchStatus& status)
+{
+	AccumulateBatchResults(pResults, batch, status);
+}
+
+template <int nNumSlots>
+static void SimulateBatchFixed(SCombinationResult* pResults, const SSimulationBatch& batch)
+{
+	SimulateBatchSlots<nNumSlots>(pResults, batch, 0, SBatchStatus(SSimulationStatus(), batch.GetLanes()));
+}
+
+typedef void (*TSimulateBatchFixed)(SCombinationResult* pResults, const SSimulationBatch& batch);
+
+template <size_t... nNumSlots>
+static const std::array<TSimulateBatchFixed, sizeof...(nNumSlots)>& GetSimulateBatchKernels(std::index_sequence<nNumSlots...>)
+{
+	static const std::array<TSimulateBatchFixed, sizeof...(nNumSlots)> aKernels = {{ &SimulateBatchFixed<static_cast<int>(nNumSlots)>... }};
+	return aKernels;
+}
+
+// Slots left at the end of a permutation that the full solve simulates as one batch, every order they can be played in fits in its lanes
+const int SIMULATION_BATCH_TRIE_SLOTS = 3;
+
+static constexpr int GetFactorial(int nValue)
+{
+	return (nValue <= 1) ? 1 : nValue * GetFactorial(nValue - 1);
+}
+static_assert(GetFactorial(SIMULATION_BATCH_TRIE_SLOTS) <= SIMULATION_BATCH_LANES, "Every permutation of the batched slots needs a lane");
+
+typedef void (*TSimulateBatchSlots)(SCombinationResult* pResults, const SSimulationBatch& batch, int nSlot, const SBatchStatus& status);
+
+template <size_t... nNumSlots>
+static const std::array<TSimulateBatchSlots, sizeof...(nNumSlots)>& GetSimulateBatchSlotsKernels(std::index_sequence<nNumSlots...>)
+{
+	static const std::array<TSimulateBatchSlots, sizeof...(nNumSlots)> aKernels = {{ &SimulateBatchSlots<static_cast<int>(nNumSlots)>... }};
+	return aKernels;
+}
+
+// Path state for simulating a single goal: chance and favor feed every goal's strict EV, the statistic is the one the goal's params test.
+// nCurrent is the streak or favor the statistic is the max of, for goals that need one.
+struct SGoalStatus
+{
+	double fChance = 1.0f;
+	int nAccumulatedFavor = 0;
+	int nCurrentMaxFavor = 0;
+	int nStatistic = 0;
+	int nCurrent = 0;
+};
+
+// ApplySpark, keeping only what eGoal needs
+template <EGoal eGoal>
+static void ApplyGoalSpark(SGoalStatus& status, int nFavorGain, double fSparkChance)
+{
+	status.nCurrentMaxFavor += nFavorGain;
+	status.nAccumulatedFavor += status.nCurrentMaxFavor;
+	switch (eGoal)
+	{
+	case GOAL_SPARK:
+		++status.nStatistic;
+		break;
+	case GOAL_CONSECUTIVE_SPARK:
+		status.nStatistic = std::max(status.nStatistic, ++status.nCurrent);
+		break;
+	case GOAL_CONSECUTIVE_SPARK_FAILURE:
+		status.nCurrent = 0;
+		break;
+	case GOAL_ACCUMULATED_FAVOR:
+		status.nStatistic = status.nAccumulatedFavor;
+		break;
+	case GOAL_MAX_FAVOR:
+		status.nStatistic = std::max(status.nStatistic, status.nCurrentMaxFavor);
+		break;
+	default:
+		break;
+	}
+	status.fChance *= fSparkChance;
+}
+
+// ApplySparkFailure, keeping only what eGoal needs
+template <EGoal eGoal>
+static void ApplyGoalSparkFailure(SGoalStatus& status, double fSparkChance)
+{
+	status.nCurrentMaxFavor = 0;
+	switch (eGoal)
+	{
+	case GOAL_SPARK_FAILURE:
+		++status.nStatistic;
+		break;
+	case GOAL_CONSECUTIVE_SPARK:
+		status.nCurrent = 0;
+		break;
+	case GOAL_CONSECUTIVE_SPARK_FAILURE:
+		status.nStatistic = std::max(status.nStatistic, ++status.nCurrent);
+		break;
+	default:
+		break;
+	}
+	status.fChance *= (1.0f - fSparkChance);
+}
+
+// Same as AccumulateResult for one goal
+template <EGoal eGoal>
+static void AccumulateGoalResult(SCombinationResult& result, const SGoalStatus& status)
+{
+	const double fModifiedAccumulatedFavor = status.fChance * status.nAccumulatedFavor;
+	if (g_Env.eGoalAccumulation == GOAL_ACCUMULATION_HISTOGRAM)
+	{
+		auto& histogram = result.aGoalHistograms[eGoal];
+		const int nBin = std::min((eGoal == GOAL_FREE_TALK) ? 0 : status.nStatistic, static_cast<int>(histogram.vChance.size()) - 1);
+		histogram.vChance[nBin] += status.fChance;
+		histogram.vModifiedAccumulatedFavor[nBin] += fModifiedAccumulatedFavor;
+		return;
+	}
+
+	auto& vBest = result.bestCombinationStats.aBestCombinations[eGoal];
+	const int nNumGoalParams = static_cast<int>(vBest.size());
+	for (int nGoalParam = 0 ; nGoalParam < nNumGoalParams && (eGoal == GOAL_FREE_TALK || status.nStatistic >= nGoalParam) ; ++nGoalParam)
+	{
+		vBest[nGoalParam].fSuccessPercentage += status.fChance;
+		vBest[nGoalParam].fStrictEV += fModifiedAccumulatedFavor;
+	}
+}
+
+// SimulateFixedSlots for a single goal, with a fraction of the state to copy per branch and one goal to accumulate
+template <EGoal eGoal, int nRemainingSlots>
+struct SGoalKernel
+{
+	static void Simulate(SCombinationResult& result, const double* pSparkChance, const int* pFavorGain, const SGoalStatus& status)
 	{
-		if (vSlots.size() != constellation.nNumSlots)
+		const double fSparkChance = *pSparkChance;
+
+		SGoalStatus sparkStatus = status;
+		ApplyGoalSpark<eGoal>(sparkStatus, *pFavorGain, fSparkChance);
+		SGoalKernel<eGoal, nRemainingSlots - 1>::Simulate(result, pSparkChance + 1, pFavorGain + 1, sparkStatus);
+
+		if (fSparkChance < 1.0f)
 		{
-			printf("Slot count doesn't match constellations: %d vs. %d\n", static_cast<int>(vSlots.size()), constellation.nNumSlots);
-			return;
+			SGoalStatus failureStatus = status;
+			ApplyGoalSparkFailure<eGoal>(failureStatus, fSparkChance);
+			SGoalKernel<eGoal, nRemainingSlots - 1>::Simulate(result, pSparkChance + 1, pFavorGain + 1, failureStatus);
+		}
+	}
+};
+
+template <EGoal eGoal>
+struct SGoalKernel<eGoal, 0>
+{
+	static void Simulate(SCombinationResult& result, const double*, const int*, const SGoalStatus& status)
+	{
+		AccumulateGoalResult<eGoal>(result, status);
+	}
+};
+
+template <EGoal eGoal, int nNumSlots>
+static void SimulateGoalFixed(SCombinationResult& result, const SSimulationTimeline& timeline)
+{
+	SGoalKernel<eGoal, nNumSlots>::Simulate(result, timeline.aSparkChance.data(), timeline.aFavorGain.data(), SGoalStatus());
+}
+
+template <EGoal eGoal, size_t... nNumSlots>
+static const std::array<TSimulateFixed, sizeof...(nNumSlots)>& GetSimulateGoalKernels(std::index_sequence<nNumSlots...>)
+{
+	static const std::array<TSimulateFixed, sizeof...(nNumSlots)> aKernels = {{ &SimulateGoalFixed<eGoal, static_cast<int>(nNumSlots)>... }};
+	return aKernels;
+}
+
+template <EGoal eGoal>
+static TSimulateFixed GetSimulateGoalKernel(int nNumSlots)
+{
+	const auto& aKernels = GetSimulateGoalKernels<eGoal>(std::make_index_sequence<MAX_CONSTELLATION_SLOTS + 1>());
+	return (nNumSlots >= 0 && nNumSlots < static_cast<int>(aKernels.size())) ? aKernels[nNumSlots] : nullptr;
+}
+
+// Plays one more slot for every path in vFrontier, the paths stay in the same order the branch tree walks them
+static void ExtendFrontier(std::vector<SSimulationStatus>& vNextFrontier, const std::vector<SSimulationStatus>& vFrontier, double fSparkChance, int nFavorGain)
+{
+	const bool bCanFail = (fSparkChance < 1.0f);
+	vNextFrontier.resize(vFrontier.size() * (bCanFail ? 2 : 1));
+
+	SSimulationStatus* pNextPath = vNextFrontier.data();
+	for (const SSimulationStatus& pathStatus : vFrontier)
+	{
+		*pNextPath = pathStatus;
+		ApplySpark(*pNextPath++, nFavorGain, fSparkChance);
+
+		if (bCanFail)
+		{
+			*pNextPath = pathStatus;
+			ApplySparkFailure(*pNextPath++, fSparkChance);
 		}
 	}
+}
+
+// pSlots holds a knowledge table index for each of the nNumSlots slots
+static void Simulate(SCombinationResult& result, int nTargetInterestLevel, int nTargetFavor, const SConstellation& constellation, const SKnowledgeTable& knowledgeTable, const int* pSlots, int nNumSlots)
+{
+	if (g_Env.bSafetyChecks)
+	{
+		if (nNumSlots != constellation.nNumSlots)
+		{
+			printf("Slot count doesn't match constellations: %d vs. %d\n", nNumSlots, constellation.nNumSlots);
+			return;
+		}
+	}
+
+	SSimulationTimeline timeline;
+	BuildTimeline(timeline, nTargetInterestLevel, nTargetFavor, constellation, knowledgeTable, pSlots);
+
+	SimulateTree(result, timeline);
+	FinalizeResult(result);
+}
+
+// Same results as calling Simulate on each permutation, pSlots holds the constellation's slot count of knowledge table indices
+// for each of the nNumPermutations permutations back to back. SIMULATION_BATCH_LANES permutations are simulated permutations at a time in lockstep.
+static void SimulateBatch(SCombinationResult* pResults, int nTargetInterestLevel, int nTargetFavor, const SConstellation& constellation, const SKnowledgeTable& knowledgeTable,
+	const int* pSlots, int nNumPermutations)
+{
+	const int nNumSlots = constellation.nNumSlots;
+	const auto& aKernels = GetSimulateBatchKernels(std::make_index_sequence<MAX_CONSTELLATION_SLOTS + 1>());
+	if (nNumSlots < 0 || nNumSlots >= static_cast<int>(aKernels.size()))
+	{
+		for (int nPermutation = 0 ; nPermutation < nNumPermutations ; ++nPermutation)
+		{
+			Simulate(pResults[nPermutation], nTargetInterestLevel, nTargetFavor, constellation, knowledgeTable, pSlots + nPermutation * nNumSlots, nNumSlots);
+		}
+		return;
+	}
+
+	SSimulationBatch batch;
+	SSimulationTimeline timeline;
+	for (int nFirstPermutation = 0 ; nFirstPermutation < nNumPermutations ; nFirstPermutation += SIMULATION_BATCH_LANES)
+	{
+		const int nNumLanes = std::min(SIMULATION_BATCH_LANES, nNumPermutations - nFirstPermutation);
+		batch.Clear(nNumSlots);
+		for (int nLane = 0 ; nLane < nNumLanes ; ++nLane)
+		{
+			BuildTimeline(timeline, nTargetInterestLevel, nTargetFavor, constellation, knowledgeTable, pSlots + (nFirstPermutation + nLane) * nNumSlots);
+			batch.AddLane(timeline);
+		}
+
+		aKernels[nNumSlots](pResults + nFirstPermutation, batch);
+		for (int nLane = 0 ; nLane < nNumLanes ; ++nLane)
+		{
+			FinalizeResult(pResults[nFirstPermutation + nLane]);
+		}
+	}
+}
+
+// Simulate for one goal, only that goal's results are meaningful afterwards so only that goal needs clearing beforehand
+static void SimulateGoal(EGoal eGoal, SCombinationResult& result, int nTargetInterestLevel, int nTargetFavor, const SConstellation& constellation, const SKnowledgeTable& knowledgeTable,
+	const int* pSlots, int nNumSlots)
+{
+	TSimulateFixed pKernel = nullptr;
+	switch (eGoal)
+	{
+	case GOAL_SPARK:
+		pKernel = GetSimulateGoalKernel<GOAL_SPARK>(nNumSlots);
+		break;
+	case GOAL_SPARK_FAILURE:
+		pKernel = GetSimulateGoalKernel<GOAL_SPARK_FAILURE>(nNumSlots);
+		break;
+	case GOAL_CONSECUTIVE_SPARK:
+		pKernel = GetSimulateGoalKernel<GOAL_CONSECUTIVE_SPARK>(nNumSlots);
+		break;
+	case GOAL_CONSECUTIVE_SPARK_FAILURE:
+		pKernel = GetSimulateGoalKernel<GOAL_CONSECUTIVE_SPARK_FAILURE>(nNumSlots);
+		break;
+	case GOAL_ACCUMULATED_FAVOR:
+		pKernel = GetSimulateGoalKernel<GOAL_ACCUMULATED_FAVOR>(nNumSlots);
+		break;
+	case GOAL_MAX_FAVOR:
+		pKernel = GetSimulateGoalKernel<GOAL_MAX_FAVOR>(nNumSlots);
+		break;
+	case GOAL_FREE_TALK:
+		pKernel = GetSimulateGoalKernel<GOAL_FREE_TALK>(nNumSlots);
+		break;
+	default:
+		break;
+	}
+
+	if (pKernel == nullptr || nNumSlots != constellation.nNumSlots)
+	{
+		result.Clear();
+		Simulate(result, nTargetInterestLevel, nTargetFavor, constellation, knowledgeTable, pSlots, nNumSlots);
+		return;
+	}
+
+	SSimulationTimeline timeline;
+	BuildTimeline(timeline, nTargetInterestLevel, nTargetFavor, constellation, knowledgeTable, pSlots);
+	pKernel(result, timeline);
+	FinalizeGoalResult(result, eGoal);
+}
+
+// Same rule the solvers have always used to decide if a result replaces the current best
+static bool IsBetterCombination(const SBestCombinations::SBestCombination& candidate, const SBestCombinations::SBestCombination& incumbent)
+{
+	const double fSuccessDeltaEV = (incumbent.fSuccessPercentage - candidate.fSuccessPercentage) * g_Env.fDeltaSuccessEVMultiplier;
+	return (candidate.fStrictEV > (incumbent.fStrictEV + fSuccessDeltaEV));
+}
+
+// Order the full solve used to enumerate permutations in: sorted combinations first, then the permutation itself.
+// Sorted combinations compare by the smallest knowledge ID that's only in one of them, which avoids sorting either side.
+static bool IsEarlierPermutation(const TKnowledgeID* pLHS, const TKnowledgeID* pRHS, int nNumSlots)
+{
+	int nSmallestOnlyLHS = INT_MAX;
+	int nSmallestOnlyRHS = INT_MAX;
+	for (int nSlot = 0 ; nSlot < nNumSlots ; ++nSlot)
+	{
+		if (pLHS[nSlot] < nSmallestOnlyLHS && std::find(pRHS, pRHS + nNumSlots, pLHS[nSlot]) == pRHS + nNumSlots)
+		{
+			nSmallestOnlyLHS = pLHS[nSlot];
+		}
+		if (pRHS[nSlot] < nSmallestOnlyRHS && std::find(pLHS, pLHS + nNumSlots, pRHS[nSlot]) == pLHS + nNumSlots)
+		{
+			nSmallestOnlyRHS = pRHS[nSlot];
+		}
+	}
+
+	if (nSmallestOnlyLHS != nSmallestOnlyRHS)
+	{
+		return nSmallestOnlyLHS < nSmallestOnlyRHS;
+	}
+	return std::lexicographical_compare(pLHS, pLHS + nNumSlots, pRHS, pRHS + nNumSlots);
+}
+
+// Ties go to the permutation the old exhaustive loop would have seen first, so the result doesn't depend on the order permutations are visited in.
+// That includes goal params no permutation can reach, where every permutation ties with a score of 0.
+static bool ReplaceBestCombination(SBestCombinations::SBestCombination& best, const SBestCombinations::SBestCombination& candidate, const TKnowledgeID* pKnowledge, int nNumSlots)
+{
+	bool bReplaceBest = (best.vKnowledge.empty() || IsBetterCombination(candidate, best));
+	if (!bReplaceBest && !IsBetterCombination(best, candidate) && static_cast<int>(best.vKnowledge.size()) == nNumSlots)
+	{
+		bReplaceBest = IsEarlierPermutation(pKnowledge, best.vKnowledge.data(), nNumSlots);
+	}
+
+	if (bReplaceBest)
+	{
+		best.fStrictEV = candidate.fStrictEV;
+		best.fSuccessPercentage = candidate.fSuccessPercentage;
+		best.vKnowledge.assign(pKnowledge, pKnowledge + nNumSlots);
+	}
+	return bReplaceBest;
+}
+
+// Replaces the target's best combinations with the permutation's results where they're better
+static void UpdateBestCombinations(SBestCombinations& targetBest, SCombinationResult& result, const TKnowledgeID* pKnowledge, int nNumSlots)
+{
+	for (int nGoal = 0 ; nGoal < NUM_GOALS ; ++nGoal)
+	{
+		auto& vTargetBest = targetBest.aBestCombinations[nGoal];
+		auto& vResultBest = result.bestCombinationStats.aBestCombinations[nGoal];
+
+		const int nNumGoalParams = static_cast<int>(vTargetBest.size());
+		for (int nGoalParam = 0 ; nGoalParam < nNumGoalParams ; ++nGoalParam)
+		{
+			auto& resultBest = vResultBest[nGoalParam];
+			resultBest.fStrictEV *= resultBest.fSuccessPercentage;
+			ReplaceBestCombination(vTargetBest[nGoalParam], resultBest, pKnowledge, nNumSlots);
+		}
+	}
+}
+
+// Folds one solve thread's best combinations into the target's. The replace rule is order independent, so the merged
+// result is the same whatever the thread count.
+static void MergeBestCombinations(SBestCombinations& targetBest, const SBestCombinations& sourceBest)
+{
+	for (int nGoal = 0 ; nGoal < NUM_GOALS ; ++nGoal)
+	{
+		auto& vTargetBest = targetBest.aBestCombinations[nGoal];
+		const auto& vSourceBest = sourceBest.aBestCombinations[nGoal];
+
+		const int nNumGoalParams = static_cast<int>(vTargetBest.size());
+		for (int nGoalParam = 0 ; nGoalParam < nNumGoalParams ; ++nGoalParam)
+		{
+			const auto& source = vSourceBest[nGoalParam];
+			if (source.vKnowledge.empty())
+			{
+				continue;
+			}
+			ReplaceBestCombination(vTargetBest[nGoalParam], source, source.vKnowledge.data(), static_cast<int>(source.vKnowledge.size()));
+		}
+	}
+}
+
+// Knowledge the simulation can't tell apart, swapping one for the other never changes a result.
+// A combo effect without a length is never applied, so the rest of it doesn't matter.
+static bool IsEquivalentKnowledge(const SKnowledgeTable& knowledgeTable, int nLHS, int nRHS)
+{
+	if (knowledgeTable.vInterest[nLHS] != knowledgeTable.vInterest[nRHS] || knowledgeTable.vAverageFavor[nLHS] != knowledgeTable.vAverageFavor[nRHS])
+	{
+		return false;
+	}
+
+	const bool bLHSHasCombo = (knowledgeTable.vComboLength[nLHS] > 0);
+	const bool bRHSHasCombo = (knowledgeTable.vComboLength[nRHS] > 0);
+	if (!bLHSHasCombo || !bRHSHasCombo)
+	{
+		return (bLHSHasCombo == bRHSHasCombo);
+	}
+	return (knowledgeTable.vComboDelay[nLHS] == knowledgeTable.vComboDelay[nRHS] && knowledgeTable.vComboLength[nLHS] == knowledgeTable.vComboLength[nRHS]
+		&& knowledgeTable.vComboInterest[nLHS] == knowledgeTable.vComboInterest[nRHS] && knowledgeTable.vComboFavor[nLHS] == knowledgeTable.vComboFavor[nRHS]);
+}
+
+// One target state walked by a permutation trie. A grid solve walks every permutation once against all of its cells,
+// each with its own timeline, frontiers and best combinations.
+struct STrieCell
+{
+	std::array<std::vector<SSimulationStatus>, MAX_CONSTELLATION_SLOTS + 1> aFrontiers;
+	std::array<STimelineCursor, MAX_CONSTELLATION_SLOTS + 1> aCursors;
+	SSimulationTimeline timeline;
+	SBestCombinations* pBest = nullptr;
+
+	// Depth the cell's permutations were pruned at, -1 while the cell is still being walked
+	int nPrunedDepth = -1;
+};
+
+// Walks every permutation of one combination as a trie over the play order. Each depth keeps the outcome distribution of its prefix,
+// so going one slot deeper only extends the parent's distribution instead of replaying the permutation from the first slot.
+struct SPermutationTrie
+{
+	SPermutationTrie(const SConstellation& constellation, const SKnowledgeTable& knowledgeTable, const int* pCombination, STargetSolve* pTargetSolves, int nNumCells)
+	: constellation(constellation)
+	, knowledgeTable(knowledgeTable)
+	, nNumSlots(static_cast<int>(constellation.vSlotOrder.size()))
+	, nNumCells(nNumCells)
+	{
+		// The cells and their frontiers keep their capacity between combinations so steady state solving doesn't allocate
+		static thread_local std::vector<STrieCell> s_vCells;
+		if (static_cast<int>(s_vCells.size()) < nNumCells)
+		{
+			s_vCells.resize(nNumCells);
+		}
+		pCells = s_vCells.data();
+
+		for (int nCell = 0 ; nCell < nNumCells ; ++nCell)
+		{
+			STrieCell& cell = pCells[nCell];
+			const STargetSolve& targetSolve = pTargetSolves[nCell];
+			cell.aFrontiers[0].assign(1, SSimulationStatus());
+			cell.aCursors.fill(STimelineCursor(targetSolve.nInterestLevel, targetSolve.nFavor));
+			cell.timeline.nNumSlots = nNumSlots;
+			cell.pBest = &pTargetSolves[nCell].bestCombinations;
+			cell.nPrunedDepth = -1;
+		}
+
+		std::copy(pCombination, pCombination + nNumSlots, aCombination.begin());
+
+		// Each knowledge's class is the first equivalent knowledge in the combination
+		for (int nKnowledge = 0 ; nKnowledge < nNumSlots ; ++nKnowledge)
+		{
+			aClasses[nKnowledge] = nKnowledge;
+			for (int nEarlier = 0 ; g_Env.bMergeEquivalentKnowledge && nEarlier < nKnowledge ; ++nEarlier)
+			{
+				if (IsEquivalentKnowledge(knowledgeTable, aCombination[nEarlier], aCombination[nKnowledge]))
+				{
+					aClasses[nKnowledge] = aClasses[nEarlier];
+					bHasEquivalents = true;
+					break;
+				}
+			}
+		}
+	}
+
+	// Only the first unused knowledge of each class is played at a slot, the others would only repeat the same results
+	bool IsRepeatedClass(int nKnowledge, unsigned int nUsedMask) const
+	{
+		for (int nEarlier = aClasses[nKnowledge] ; nEarlier < nKnowledge ; ++nEarlier)
+		{
+			if (aClasses[nEarlier] == aClasses[nKnowledge] && (nUsedMask & (1u << nEarlier)) == 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Number of distinct permutations left to play, the remaining slots over every class's remaining count
+	size_t GetNumRemainingPermutations(unsigned int nUsedMask) const
+	{
+		std::array<int, MAX_CONSTELLATION_SLOTS> aClassCounts;
+		aClassCounts.fill(0);
+
+		size_t zNumPermutations = 1;
+		int nNumRemaining = 0;
+		for (int nKnowledge = 0 ; nKnowledge < nNumSlots ; ++nKnowledge)
+		{
+			if ((nUsedMask & (1u << nKnowledge)) == 0)
+			{
+				zNumPermutations = zNumPermutations * ++nNumRemaining / ++aClassCounts[aClasses[nKnowledge]];
+			}
+		}
+		return zNumPermutations;
+	}
+
+	// Equivalent knowledge is handed out in ID order along the slots, which is the earliest of the permutations that only swap them
+	const TKnowledgeID* GetCanonicalPermutation()
+	{
+		if (!bHasEquivalents)
+		{
+			return aPermutation.data();
+		}
+
+		std::array<int, MAX_CONSTELLATION_SLOTS> aNextMembers;
+		for (int nKnowledge = 0 ; nKnowledge < nNumSlots ; ++nKnowledge)
+		{
+			aNextMembers[nKnowledge] = nKnowledge;
+		}
+		for (int nSlot = 0 ; nSlot < nNumSlots ; ++nSlot)
+		{
+			const int nClass = aClasses[aSlotKnowledge[nSlot]];
+			int& nMember = aNextMembers[nClass];
+			while (aClasses[nMember] != nClass)
+			{
+				++nMember;
+			}
+			aCanonicalPermutation[nSlot] = knowledgeTable.vIDs[aCombination[nMember++]];
+		}
+		return aCanonicalPermutation.data();
+	}
+
+	const SConstellation& constellation;
+	const SKnowledgeTable& knowledgeTable;
+	const int nNumSlots;
+	const int nNumCells;
+
+	// Knowledge table indices of the combination, in knowledge ID order
+	std::array<int, MAX_CONSTELLATION_SLOTS> aCombination;
+
+	STrieCell* pCells = nullptr;
+
+	std::array<int, MAX_CONSTELLATION_SLOTS> aClasses;
+	bool bHasEquivalents = false;
+
+	// Knowledge IDs in slot order, same layout as the permutations the solver stores
+	std::array<TKnowledgeID, MAX_CONSTELLATION_SLOTS> aPermutation;
+	std::array<TKnowledgeID, MAX_CONSTELLATION_SLOTS> aCanonicalPermutation;
+	std::array<int, MAX_CONSTELLATION_SLOTS> aSlotKnowledge;
+	size_t zNumPermutations = 0;
+	size_t zNumPrunedPermutations = 0;
+};
+
+// Highest value a goal's statistic could reach from this path if every remaining slot goes its way
+static int GetReachableGoalStatistic(EGoal eGoal, const SSimulationStatus& status, int nRemainingSlots, int nMaxAccumulatedFavorGain, int nMaxFavorGain)
+{
+	switch (eGoal)
+	{
+	case GOAL_SPARK:
+		return status.nSpark + nRemainingSlots;
+	case GOAL_SPARK_FAILURE:
+		return status.nSparkFailure + nRemainingSlots;
+	case GOAL_CONSECUTIVE_SPARK:
+		return std::max(status.nMaxConsecutiveSpark, status.nCurrentConsecutiveSpark + nRemainingSlots);
+	case GOAL_CONSECUTIVE_SPARK_FAILURE:
+		return std::max(status.nMaxConsecutiveSparkFailure, status.nCurrentConsecutiveSparkFailure + nRemainingSlots);
+	case GOAL_ACCUMULATED_FAVOR:
+		return status.nAccumulatedFavor + nRemainingSlots * status.nCurrentMaxFavor + nMaxAccumulatedFavorGain;
+	case GOAL_MAX_FAVOR:
+		return std::max(status.nMaxMaxFavor, status.nCurrentMaxFavor + nMaxFavorGain);
+	case GOAL_FREE_TALK:
+		return 0;
+	}
+	return 0;
+}
+
+// For goals that count sparks or failures: the statistic so far, and the count that more sparks or failures would add on to.
+// Reaching a goal param the statistic hasn't reached yet needs at least the difference in more sparks or failures.
+static bool GetCountedGoalStatistic(EGoal eGoal, const SSimulationStatus& status, int& nStatistic, int& nCount, bool& bCountsSparks)
+{
+	switch (eGoal)
+	{
+	case GOAL_SPARK:
+		nStatistic = status.nSpark;
+		nCount = status.nSpark;
+		bCountsSparks = true;
+		return true;
+	case GOAL_SPARK_FAILURE:
+		nStatistic = status.nSparkFailure;
+		nCount = status.nSparkFailure;
+		bCountsSparks = false;
+		return true;
+	case GOAL_CONSECUTIVE_SPARK:
+		nStatistic = status.nMaxConsecutiveSpark;
+		nCount = status.nCurrentConsecutiveSpark;
+		bCountsSparks = true;
+		return true;
+	case GOAL_CONSECUTIVE_SPARK_FAILURE:
+		nStatistic = status.nMaxConsecutiveSparkFailure;
+		nCount = status.nCurrentConsecutiveSparkFailure;
+		bCountsSparks = false;
+		return true;
+	default:
+		return false;
+	}
+}
+
+// Chance that independent slots with the given chances succeed at least N times, for every N up to the number of slots
+static void GetAtLeastChances(std::array<double, MAX_CONSTELLATION_SLOTS + 1>& aAtLeast, const std::array<double, MAX_CONSTELLATION_SLOTS>& aChances, int nNumChances)
+{
+	std::array<double, MAX_CONSTELLATION_SLOTS + 1> aExactly;
+	aExactly.fill(0.0);
+	aExactly[0] = 1.0;
+	for (int nChance = 0 ; nChance < nNumChances ; ++nChance)
+	{
+		for (int nCount = nChance + 1 ; nCount > 0 ; --nCount)
+		{
+			aExactly[nCount] = aExactly[nCount] * (1.0 - aChances[nChance]) + aExactly[nCount - 1] * aChances[nChance];
+		}
+		aExactly[0] *= (1.0 - aChances[nChance]);
+	}
+
+	double fAtLeast = 0.0;
+	for (int nCount = nNumChances ; nCount >= 0 ; --nCount)
+	{
+		fAtLeast += aExactly[nCount];
+		aAtLeast[nCount] = fAtLeast;
+	}
+}
+
+// True if the incumbent comes before every permutation of the combination in the order IsEarlierPermutation uses
+static bool IsEarlierCombination(const std::vector<TKnowledgeID>& vIncumbent, const SPermutationTrie& trie)
+{
+	const int nNumSlots = trie.nNumSlots;
+	if (static_cast<int>(vIncumbent.size()) != nNumSlots)
+	{
+		return false;
+	}
+
+	std::array<TKnowledgeID, MAX_CONSTELLATION_SLOTS> aCombination;
+	for (int nSlot = 0 ; nSlot < nNumSlots ; ++nSlot)
+	{
+		aCombination[nSlot] = trie.knowledgeTable.vIDs[trie.aCombination[nSlot]];
+	}
+
+	// Same knowledge means the order comes down to the permutations themselves
+	if (std::is_permutation(aCombination.begin(), aCombination.begin() + nNumSlots, vIncumbent.begin()))
+	{
+		return false;
+	}
+	return IsEarlierPermutation(vIncumbent.data(), aCombination.data(), nNumSlots);
+}
+
+// True if no way of filling the remaining slots can replace the best combination for any goal param.
+// Combo effects only ever move the target's interest and favor by their own size, so every remaining knowledge gets an optimistic spark chance,
+// failure chance and favor gain. The success chance and strict EV bounds built from those are never below what a permutation can score.
+static bool CanPrunePermutations(const SPermutationTrie& trie, const STrieCell& cell, int nDepth, unsigned int nUsedMask)
+{
+	const SBestCombinations& targetBest = *cell.pBest;
+	const STimelineCursor& cursor = cell.aCursors[nDepth];
+	const int nRemainingSlots = trie.nNumSlots - nDepth;
+
+	double fComboInterest = 0.0;
+	int nComboFavor = 0;
+	for (int nComboEffect = 0 ; nComboEffect < cursor.nNumComboEffects ; ++nComboEffect)
+	{
+		const SComboEffect& comboEffect = cursor.aComboEffects[nComboEffect];
+		if (comboEffect.nDelay > 0 || comboEffect.nLength > 0)
+		{
+			fComboInterest += std::abs(comboEffect.nInterest);
+			nComboFavor += std::abs(comboEffect.nFavor);
+		}
+	}
+	const SKnowledgeTable& knowledgeTable = trie.knowledgeTable;
+	for (int nKnowledge = 0 ; nKnowledge < trie.nNumSlots ; ++nKnowledge)
+	{
+		const int nIndex = trie.aCombination[nKnowledge];
+		if ((nUsedMask & (1u << nKnowledge)) == 0 && knowledgeTable.vComboLength[nIndex] > 0)
+		{
+			fComboInterest += std::abs(knowledgeTable.vComboInterest[nIndex]);
+			nComboFavor += std::abs(knowledgeTable.vComboFavor[nIndex]);
+		}
+	}
+	const double fMinTargetInterestLevel = std::max(cursor.fTargetInterestLevel - fComboInterest, DBL_EPSILON);
+	const double fMaxTargetInterestLevel = std::max(cursor.fTargetInterestLevel + fComboInterest, DBL_EPSILON);
+	const int nMinTargetFavor = cursor.nTargetFavor - nComboFavor;
+
+	std::array<double, MAX_CONSTELLATION_SLOTS> aSparkChances;
+	std::array<double, MAX_CONSTELLATION_SLOTS> aFailureChances;
+	std::array<int, MAX_CONSTELLATION_SLOTS> aFavorGains;
+	double fMaxSparkChance = 0.0;
+	int nNumRemaining = 0;
+	for (int nKnowledge = 0 ; nKnowledge < trie.nNumSlots ; ++nKnowledge)
+	{
+		if ((nUsedMask & (1u << nKnowledge)) != 0)
+		{
+			continue;
+		}
+
+		const int nIndex = trie.aCombination[nKnowledge];
+		aSparkChances[nNumRemaining] = std::min(knowledgeTable.vInterest[nIndex] / fMinTargetInterestLevel, 1.0);
+		aFailureChances[nNumRemaining] = 1.0 - std::min(knowledgeTable.vInterest[nIndex] / fMaxTargetInterestLevel, 1.0);
+		aFavorGains[nNumRemaining] = std::max(1, knowledgeTable.vAverageFavor[nIndex] - nMinTargetFavor);
+		fMaxSparkChance = std::max(fMaxSparkChance, aSparkChances[nNumRemaining]);
+		++nNumRemaining;
+	}
+
+	// Biggest gains first, a spark's gain is added to the accumulated favor again for every spark after it
+	std::sort(aFavorGains.begin(), aFavorGains.begin() + nNumRemaining, std::greater<int>());
+	int nMaxFavorGain = 0;
+	int nMaxAccumulatedFavorGain = 0;
+	for (int nRemaining = 0 ; nRemaining < nNumRemaining ; ++nRemaining)
+	{
+		nMaxFavorGain += aFavorGains[nRemaining];
+		nMaxAccumulatedFavorGain += aFavorGains[nRemaining] * (nNumRemaining - nRemaining);
+	}
+
+	// Remaining sparks and failures are at most as likely as with every slot at its optimistic chance
+	std::array<double, MAX_CONSTELLATION_SLOTS + 1> aAtLeastSparks;
+	std::array<double, MAX_CONSTELLATION_SLOTS + 1> aAtLeastFailures;
+	GetAtLeastChances(aAtLeastSparks, aSparkChances, nNumRemaining);
+	GetAtLeastChances(aAtLeastFailures, aFailureChances, nNumRemaining);
+
+	static thread_local std::vector<double> s_vChance;
+	static thread_local std::vector<double> s_vFavor;
+	static thread_local std::vector<double> s_vCountedChance;
+
+	const auto& vFrontier = cell.aFrontiers[nDepth];
+	for (int nGoal = 0 ; nGoal < NUM_GOALS ; ++nGoal)
+	{
+		const EGoal eGoal = static_cast<EGoal>(nGoal);
+		const auto& vTargetBest = targetBest.aBestCombinations[nGoal];
+		const int nNumGoalParams = static_cast<int>(vTargetBest.size());
+
+		// Chance and expected favor of the paths that can still reach each goal param, binned then summed from the top like the histogram results.
+		// Counted goals also bin by statistic and count, which bounds the chance with the optimistic spark and failure chances.
+		int nStatistic = 0;
+		int nCount = 0;
+		bool bCountsSparks = false;
+		const bool bCounted = GetCountedGoalStatistic(eGoal, SSimulationStatus(), nStatistic, nCount, bCountsSparks);
+
+		s_vChance.assign(nNumGoalParams, 0.0);
+		s_vFavor.assign(nNumGoalParams, 0.0);
+		s_vCountedChance.assign(bCounted ? nNumGoalParams * nNumGoalParams : 0, 0.0);
+		for (const SSimulationStatus& pathStatus : vFrontier)
+		{
+			const int nReachable = GetReachableGoalStatistic(eGoal, pathStatus, nRemainingSlots, nMaxAccumulatedFavorGain, nMaxFavorGain);
+			if (nReachable < 0)
+			{
+				continue;
+			}
+
+			// Every later spark adds at most the current max favor plus the biggest gains, and no slot sparks more often than the best remaining chance
+			const double fExpectedFavor = pathStatus.nAccumulatedFavor + fMaxSparkChance * (nRemainingSlots * pathStatus.nCurrentMaxFavor + nMaxAccumulatedFavorGain);
+
+			const int nBin = std::min(nReachable, nNumGoalParams - 1);
+			s_vChance[nBin] += pathStatus.fChance;
+			s_vFavor[nBin] += pathStatus.fChance * fExpectedFavor;
+
+			if (bCounted)
+			{
+				GetCountedGoalStatistic(eGoal, pathStatus, nStatistic, nCount, bCountsSparks);
+				s_vCountedChance[std::min(nStatistic, nNumGoalParams - 1) * nNumGoalParams + std::min(nCount, nNumGoalParams - 1)] += pathStatus.fChance;
+			}
+		}
+		for (int nGoalParam = nNumGoalParams - 2 ; nGoalParam >= 0 ; --nGoalParam)
+		{
+			s_vChance[nGoalParam] += s_vChance[nGoalParam + 1];
+			s_vFavor[nGoalParam] += s_vFavor[nGoalParam + 1];
+		}
+
+		const auto& aAtLeast = bCountsSparks ? aAtLeastSparks : aAtLeastFailures;
+		for (int nGoalParam = 0 ; nGoalParam < nNumGoalParams ; ++nGoalParam)
+		{
+			const auto& best = vTargetBest[nGoalParam];
+			if (best.vKnowledge.empty())
+			{
+				return false;
+			}
+
+			double fSuccess = s_vChance[nGoalParam];
+			if (bCounted)
+			{
+				double fCountedSuccess = 0.0;
+				for (int nStatisticBin = 0 ; nStatisticBin < nNumGoalParams ; ++nStatisticBin)
+				{
+					for (int nCountBin = 0 ; nCountBin < nNumGoalParams ; ++nCountBin)
+					{
+						const double fChance = s_vCountedChance[nStatisticBin * nNumGoalParams + nCountBin];
+						const int nNeeded = nGoalParam - nCountBin;
+						if (nStatisticBin >= nGoalParam || nNeeded <= 0)
+						{
+							fCountedSuccess += fChance;
+						}
+						else if (nNeeded <= nNumRemaining)
+						{
+							fCountedSuccess += fChance * aAtLeast[nNeeded];
+						}
+					}
+				}
+				fSuccess = std::min(fSuccess, fCountedSuccess);
+			}
+
+			// Nothing down here can succeed, so every permutation scores exactly zero and the replace rule can be asked directly.
+			// Ties go to the earlier permutation, which is only known up front when the incumbent is from another combination.
+			if (fSuccess == 0.0)
+			{
+				const SBestCombinations::SBestCombination zeroCombination;
+				if (IsBetterCombination(zeroCombination, best))
+				{
+					return false;
+				}
+				if (!IsBetterCombination(best, zeroCombination) && !IsEarlierCombination(best.vKnowledge, trie))
+				{
+					return false;
+				}
+				continue;
+			}
+
+			// Same score IsBetterCombination compares, with some slack so rounding can never prune a tie or a winner
+			const double fMaxScore = s_vFavor[nGoalParam] * fSuccess + fSuccess * g_Env.fDeltaSuccessEVMultiplier;
+			const double fBestScore = best.fStrictEV + best.fSuccessPercentage * g_Env.fDeltaSuccessEVMultiplier;
+			if (fMaxScore >= fBestScore - 1e-9 * std::max(1.0, std::abs(fBestScore)))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+typedef std::array<int, SIMULATION_BATCH_TRIE_SLOTS> TTrieBatchPermutation;
+
+// The orders the knowledge nUsedMask leaves can be played in, as the knowledge played at each depth from nFirstDepth on.
+// They come out in the order SimulatePermutationTrie would walk them.
+static void GetTrieBatchPermutations(const SPermutationTrie& trie, int nDepth, int nFirstDepth, unsigned int nUsedMask, TTrieBatchPermutation& permutation,
+	std::array<TTrieBatchPermutation, SIMULATION_BATCH_LANES>& aPermutations, int& nNumPermutations)
+{
+	if (nDepth >= trie.nNumSlots)
+	{
+		aPermutations[nNumPermutations++] = permutation;
+		return;
+	}
+
+	for (int nKnowledge = 0 ; nKnowledge < trie.nNumSlots ; ++nKnowledge)
+	{
+		if ((nUsedMask & (1u << nKnowledge)) != 0 || trie.IsRepeatedClass(nKnowledge, nUsedMask))
+		{
+			continue;
+		}
+		permutation[nDepth - nFirstDepth] = nKnowledge;
+		GetTrieBatchPermutations(trie, nDepth + 1, nFirstDepth, nUsedMask | (1u << nKnowledge), permutation, aPermutations, nNumPermutations);
+	}
+}
+
+// Finishes the trie's last few slots with one lane per way of playing them. Each path of the prefix's frontier is walked through every lane at once,
+// and a lane accumulates its paths in the same order as the leaf of the trie it stands in for.
+static void SimulatePermutationTrieBatch(SPermutationTrie& trie, SCombinationResult* pResults, int nDepth, unsigned int nUsedMask)
+{
+	std::array<TTrieBatchPermutation, SIMULATION_BATCH_LANES> aPermutations;
+	TTrieBatchPermutation permutation;
+	int nNumPermutations = 0;
+	GetTrieBatchPermutations(trie, nDepth, nDepth, nUsedMask, permutation, aPermutations, nNumPermutations);
+
+	const auto& aKernels = GetSimulateBatchSlotsKernels(std::make_index_sequence<SIMULATION_BATCH_TRIE_SLOTS + 1>());
+	const TSimulateBatchSlots pKernel = aKernels[trie.nNumSlots - nDepth];
+	SSimulationBatch batch;
+	for (int nCell = 0 ; nCell < trie.nNumCells ; ++nCell)
+	{
+		STrieCell& cell = trie.pCells[nCell];
+		if (cell.nPrunedDepth >= 0)
+		{
+			continue;
+		}
+
+		batch.Clear(trie.nNumSlots, nDepth);
+		for (int nPermutation = 0 ; nPermutation < nNumPermutations ; ++nPermutation)
+		{
+			STimelineCursor cursor = cell.aCursors[nDepth];
+			for (int nLaneDepth = nDepth ; nLaneDepth < trie.nNumSlots ; ++nLaneDepth)
+			{
+				AdvanceTimeline(cell.timeline, cursor, nLaneDepth, trie.knowledgeTable, trie.aCombination[aPermutations[nPermutation][nLaneDepth - nDepth]]);
+			}
+			batch.AddLane(cell.timeline, nDepth);
+			pResults[nPermutation].Clear();
+		}
+
+		for (const SSimulationStatus& pathStatus : cell.aFrontiers[nDepth])
+		{
+			pKernel(pResults, batch, nDepth, SBatchStatus(pathStatus, batch.GetLanes()));
+		}
+
+		for (int nPermutation = 0 ; nPermutation < nNumPermutations ; ++nPermutation)
+		{
+			for (int nLaneDepth = nDepth ; nLaneDepth < trie.nNumSlots ; ++nLaneDepth)
+			{
+				const int nKnowledge = aPermutations[nPermutation][nLaneDepth - nDepth];
+				trie.aPermutation[trie.constellation.vSlotOrder[nLaneDepth]] = trie.knowledgeTable.vIDs[trie.aCombination[nKnowledge]];
+				trie.aSlotKnowledge[trie.constellation.vSlotOrder[nLaneDepth]] = nKnowledge;
+			}
+			++trie.zNumPermutations;
+
+			FinalizeResult(pResults[nPermutation]);
+			UpdateBestCombinations(*cell.pBest, pResults[nPermutation], trie.GetCanonicalPermutation(), trie.nNumSlots);
+		}
+	}
+}
+
+// Walks every permutation of the trie's combination for every cell that hasn't been pruned yet.
+// Enumeration and the canonical permutation are shared, only the timelines and frontiers are per cell.
+// pResults has room for SIMULATION_BATCH_LANES results.
+static void SimulatePermutationTrie(SPermutationTrie& trie, SCombinationResult* pResults, int nDepth, unsigned int nUsedMask)
+{
+	// Pruning stops at the node the batch kernel takes over from. One bound there covers every batched slot and can skip the whole batch,
+	// the batched slots themselves are never walked one at a time so they're never bounded on their own.
+	const int nNumRemainingSlots = trie.nNumSlots - nDepth;
+	const bool bBatch = (nNumRemainingSlots <= SIMULATION_BATCH_TRIE_SLOTS);
+	const bool bPrune = (g_Env.bPrunePermutations && nNumRemainingSlots >= SIMULATION_BATCH_TRIE_SLOTS);
+
+	int nNumActiveCells = 0;
+	size_t zNumRemainingPermutations = 0;
+	for (int nCell = 0 ; nCell < trie.nNumCells ; ++nCell)
+	{
+		STrieCell& cell = trie.pCells[nCell];
+		if (cell.nPrunedDepth >= 0)
+		{
+			continue;
+		}
+
+		if (bPrune && CanPrunePermutations(trie, cell, nDepth, nUsedMask))
+		{
+			if (zNumRemainingPermutations == 0)
+			{
+				zNumRemainingPermutations = trie.GetNumRemainingPermutations(nUsedMask);
+			}
+			trie.zNumPrunedPermutations += zNumRemainingPermutations;
+			cell.nPrunedDepth = nDepth;
+			continue;
+		}
+		++nNumActiveCells;
+	}
+
+	if (bBatch && nNumActiveCells > 0)
+	{
+		SimulatePermutationTrieBatch(trie, pResults, nDepth, nUsedMask);
+	}
+
+	for (int nKnowledge = 0 ; nKnowledge < trie.nNumSlots && nNumActiveCells > 0 && !bBatch ; ++nKnowledge)
+	{
+		if ((nUsedMask & (1u << nKnowledge)) != 0 || trie.IsRepeatedClass(nKnowledge, nUsedMask))
+		{
+			continue;
+		}
+
+		const int nIndex = trie.aCombination[nKnowledge];
+		trie.aPermutation[trie.constellation.vSlotOrder[nDepth]] = trie.knowledgeTable.vIDs[nIndex];
+		trie.aSlotKnowledge[trie.constellation.vSlotOrder[nDepth]] = nKnowledge;
+
+		for (int nCell = 0 ; nCell < trie.nNumCells ; ++nCell)
+		{
+			STrieCell& cell = trie.pCells[nCell];
+			if (cell.nPrunedDepth >= 0)
+			{
+				continue;
+			}
+
+			cell.aCursors[nDepth + 1] = cell.aCursors[nDepth];
+			AdvanceTimeline(cell.timeline, cell.aCursors[nDepth + 1], nDepth, trie.knowledgeTable, nIndex);
+			ExtendFrontier(cell.aFrontiers[nDepth + 1], cell.aFrontiers[nDepth], cell.timeline.aSparkChance[nDepth], cell.timeline.aFavorGain[nDepth]);
+		}
+
+		SimulatePermutationTrie(trie, pResults, nDepth + 1, nUsedMask | (1u << nKnowledge));
+	}
+
+	// Cells pruned here are walked again by the next branch up
+	for (int nCell = 0 ; nCell < trie.nNumCells ; ++nCell)
+	{
+		STrieCell& cell = trie.pCells[nCell];
+		if (cell.nPrunedDepth == nDepth)
+		{
+			cell.nPrunedDepth = -1;
+		}
+	}
+}
+
+// Whether a solve started at solveStartTime has used up its time budget, never for solves without one
+static bool IsSolveOutOfTime(const std::chrono::steady_clock::time_point& solveStartTime)
+{
+	return g_Env.fSolveTimeBudget > 0.0 && std::chrono::duration<double>(std::chrono::steady_clock::now() - solveStartTime).count() >= g_Env.fSolveTimeBudget;
+}
+
+// Order combinations are drawn from the knowledge in. Without a time budget it's table order. With one, knowledge that alone is expected to give
+// the most favor at the target's interest and favor comes first, so the combinations simulated before the budget runs out are the likely winners.
+static void GetSolveKnowledgeOrder(std::vector<int>& vKnowledgeOrder, const SKnowledgeTable& knowledgeTable, int nTargetInterestLevel, int nTargetFavor)
+{
+	const int nNumKnowledge = knowledgeTable.GetNumKnowledge();
+	vKnowledgeOrder.resize(nNumKnowledge);
+	for (int nKnowledge = 0 ; nKnowledge < nNumKnowledge ; ++nKnowledge)
+	{
+		vKnowledgeOrder[nKnowledge] = nKnowledge;
+	}
+
+	if (g_Env.fSolveTimeBudget <= 0.0)
+	{
+		return;
+	}
+
+	std::vector<double> vExpectedFavor(nNumKnowledge);
+	for (int nKnowledge = 0 ; nKnowledge < nNumKnowledge ; ++nKnowledge)
+	{
+		const double fSparkChance = std::min(knowledgeTable.vInterest[nKnowledge] / std::max(static_cast<double>(nTargetInterestLevel), DBL_EPSILON), 1.0);
+		vExpectedFavor[nKnowledge] = fSparkChance * std::max(1, knowledgeTable.vAverageFavor[nKnowledge] - nTargetFavor);
+	}
+	std::stable_sort(vKnowledgeOrder.begin(), vKnowledgeOrder.end(), [&](int nLHS, int nRHS)
+	{
+		return vExpectedFavor[nLHS] > vExpectedFavor[nRHS];
+	});
+}
+
+// Progress printing shared by a solve's threads. Whichever thread gets here first once g_Env.fSolvePrintTime has passed prints,
+// so a thread held up by slow chunks doesn't hold up the output.
+class CSolvePrintTimer
+{
+public:
+	// True if the caller should print now, with the seconds since the timer was made
+	bool IsPrintDue(double& fElapsedTime)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+		if (!lock.owns_lock())
+		{
+			return false;
+		}
+
+		const auto currentTime = std::chrono::steady_clock::now();
+		if (m_bPrinted && std::chrono::duration<double>(currentTime - m_lastPrintTime).count() < g_Env.fSolvePrintTime)
+		{
+			return false;
+		}
+		fElapsedTime = std::chrono::duration<double>(currentTime - m_startTime).count();
+		m_lastPrintTime = currentTime;
+		m_bPrinted = true;
+		return true;
+	}
+
+private:
+	std::mutex m_mutex;
+	const std::chrono::steady_clock::time_point m_startTime = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point m_lastPrintTime = m_startTime;
+	bool m_bPrinted = false;
+};
+
+// Where a solve's enumeration of combinations starts and how far it got
+struct SSolveProgress
+{
+	std::chrono::steady_clock::time_point solveStartTime = std::chrono::steady_clock::now();
+	uint64_t nCombinationsDone = 0; // Every combination ranked below this is done, resumed solves start here
+	bool bCheckpoint = false; // Stop every g_Env.nCheckpointCombinations combinations for a checkpoint once g_Env.fCheckpointTime has passed
+	bool bOutOfTime = false;
+};
+
+// Splits the combinations of the knowledge in vKnowledgeOrder into ranges of ranks and hands them to the solve threads, calling
+// fnSolveCombination(nThread, pCombination) with knowledge table indices in ascending order for each. Every range is generated on its own, so only a chunk of combinations is ever in memory.
+// Once the solve's time budget runs out the remaining ranges are skipped and bOutOfTime is set.
+// When checkpointing, the threads sync up between segments of combinations and fnCheckpoint(nCombinationsDone) is called with none of them running.
+template <typename TSolveCombination, typename TCheckpoint>
+static bool SimulateCombinationsOnThreads(const SKnowledgeTable& knowledgeTable, const SConstellation& constellation, const std::vector<int>& vKnowledgeOrder, int nNumThreads,
+	SSolveProgress& progress, const TSolveCombination& fnSolveCombination, const TCheckpoint& fnCheckpoint)
+{
+	const int nNumKnowledge = knowledgeTable.GetNumKnowledge();
+	const int nNumSlots = constellation.nNumSlots;
+	const uint64_t nNumCombinations = GetNumCombinations(nNumKnowledge, nNumSlots);
+	if (nNumCombinations > static_cast<uint64_t>(INT64_MAX))
+	{
+		printf("Too many combinations to simulate: %llu\n", static_cast<unsigned long long>(nNumCombinations));
+		return false;
+	}
+	printf("Streaming %llu combinations, beginning simulations\n", static_cast<unsigned long long>(nNumCombinations));
+	if (progress.nCombinationsDone > 0)
+	{
+		printf("Resuming after %llu combinations\n", static_cast<unsigned long long>(progress.nCombinationsDone));
+	}
+
+	// Group equivalent knowledge into classes. A combination is only simulated if it uses the smallest IDs of each class,
+	// any other choice of the same classes has the same results and comes later in the order ties are broken in.
+	// Knowledge without an earlier equivalent keeps -1.
+	std::vector<int> vPreviousEquivalents(nNumKnowledge, -1);
+	bool bHasEquivalents = false;
+	if (g_Env.bMergeEquivalentKnowledge)
+	{
+		std::vector<int> vClasses;
+		std::vector<int> vLastMembers;
+		for (int nKnowledge = 0 ; nKnowledge < nNumKnowledge ; ++nKnowledge)
+		{
+			int nClass = 0;
+			while (nClass < static_cast<int>(vClasses.size()) && !IsEquivalentKnowledge(knowledgeTable, vClasses[nClass], nKnowledge))
+			{
+				++nClass;
+			}
+			if (nClass == static_cast<int>(vClasses.size()))
+			{
+				vClasses.push_back(nKnowledge);
+				vLastMembers.push_back(nKnowledge);
+				continue;
+			}
+			vPreviousEquivalents[nKnowledge] = vLastMembers[nClass];
+			vLastMembers[nClass] = nKnowledge;
+			bHasEquivalents = true;
+		}
+		printf("Grouped %d knowledge into %d equivalence classes\n", nNumKnowledge, static_cast<int>(vClasses.size()));
+	}
+
+	// Combinations are generated over positions in vKnowledgeOrder, the generator keeps its objects sorted
+	std::vector<int> vKnowledgePositions(nNumKnowledge);
+	for (int nPosition = 0 ; nPosition < nNumKnowledge ; ++nPosition)
+	{
+		vKnowledgePositions[nPosition] = nPosition;
+	}
+
+	std::atomic<uint64_t> nCombinationsDone(progress.nCombinationsDone);
+	std::atomic<bool> bStopped(false);
+	CSolvePrintTimer printTimer;
+	auto lastCheckpointTime = std::chrono::steady_clock::now();
+
+	auto SolveChunk = [&](int nThread, int64_t nChunkBegin, int64_t nChunkEnd)
+	{
+		if (bStopped || IsSolveOutOfTime(progress.solveStartTime))
+		{
+			bStopped = true;
+			return;
+		}
+
+		double fElapsedTime = 0.0;
+		if (printTimer.IsPrintDue(fElapsedTime))
+		{
+			const uint64_t nDone = nCombinationsDone.load();
+			printf("Beginning simulation %llu (%.2f%%) - %.3fs elapsed\n", static_cast<unsigned long long>(nDone), static_cast<double>(nDone) / nNumCombinations * 100.0f, fElapsedTime);
+		}
+
+		CCombinationGenerator<int, false> combinationGenerator(vKnowledgePositions, nNumSlots, static_cast<uint64_t>(nChunkBegin));
+		std::array<int, MAX_CONSTELLATION_SLOTS> aKnowledgeCombination;
+		for (int64_t nKnowledgeCombination = nChunkBegin ; nKnowledgeCombination < nChunkEnd ; ++nKnowledgeCombination)
+		{
+			if (!combinationGenerator.Next(aKnowledgeCombination.data()))
+			{
+				break;
+			}
+			for (int nKnowledgeIndex = 0 ; nKnowledgeIndex < nNumSlots ; ++nKnowledgeIndex)
+			{
+				aKnowledgeCombination[nKnowledgeIndex] = vKnowledgeOrder[aKnowledgeCombination[nKnowledgeIndex]];
+			}
+			std::sort(aKnowledgeCombination.begin(), aKnowledgeCombination.begin() + nNumSlots);
+
+			bool bCanonical = true;
+			for (int nKnowledgeIndex = 0 ; nKnowledgeIndex < nNumSlots && bCanonical && bHasEquivalents ; ++nKnowledgeIndex)
+			{
+				const int nPrevious = vPreviousEquivalents[aKnowledgeCombination[nKnowledgeIndex]];
+				bCanonical = (nPrevious < 0 || std::binary_search(aKnowledgeCombination.begin(), aKnowledgeCombination.begin() + nNumSlots, nPrevious));
+			}
+			if (!bCanonical)
+			{
+				continue;
+			}
+
+			fnSolveCombination(nThread, aKnowledgeCombination.data());
+		}
+		nCombinationsDone += static_cast<uint64_t>(nChunkEnd - nChunkBegin);
+	};
+
+	// A segment cut short by the time budget doesn't count, its combinations are simulated again on resume
+	const uint64_t nSegmentSize = progress.bCheckpoint ? static_cast<uint64_t>(std::max<int64_t>(g_Env.nCheckpointCombinations, 1)) : nNumCombinations;
+	while (progress.nCombinationsDone < nNumCombinations && !bStopped)
+	{
+		const uint64_t nSegmentEnd = std::min(nNumCombinations, progress.nCombinationsDone + nSegmentSize);
+		ParallelForChunks(static_cast<int64_t>(progress.nCombinationsDone), static_cast<int64_t>(nSegmentEnd), g_Env.nSolveChunkSize, nNumThreads, SolveChunk);
+		if (bStopped)
+		{
+			break;
+		}
+		progress.nCombinationsDone = nSegmentEnd;
+
+		const auto currentTime = std::chrono::steady_clock::now();
+		if (progress.bCheckpoint && nSegmentEnd < nNumCombinations && std::chrono::duration<double>(currentTime - lastCheckpointTime).count() >= g_Env.fCheckpointTime)
+		{
+			fnCheckpoint(progress.nCombinationsDone);
+			lastCheckpointTime = currentTime;
+		}
+	}
+
+	progress.bOutOfTime = bStopped;
+	if (progress.bOutOfTime)
+	{
+		if (progress.bCheckpoint)
+		{
+			fnCheckpoint(progress.nCombinationsDone);
+		}
+
+		const uint64_t nDone = nCombinationsDone.load();
+		printf("Solve time budget of %.3fs ran out after %llu of %llu combinations (%.2f%%), results are provisional\n", g_Env.fSolveTimeBudget,
+			static_cast<unsigned long long>(nDone), static_cast<unsigned long long>(nNumCombinations), static_cast<double>(nDone) / nNumCombinations * 100.0f);
+	}
+
+	return true;
+}
+
+static const uint32_t s_nCheckpointMagic = 0x4B434453; // "SDCK"
+
+// FNV-1a over everything in a checkpoint before its checksum
+static uint64_t GetCheckpointChecksum(uint64_t nHash, const void* pData, size_t zSize)
+{
+	const unsigned char* pBytes = static_cast<const unsigned char*>(pData);
+	for (size_t zByte = 0 ; zByte < zSize ; ++zByte)
+	{
+		nHash = (nHash ^ pBytes[zByte]) * 1099511628211ull;
+	}
+	return nHash;
+}
+
+static std::string GetCheckpointPath(const STargetSolve& targetSolve)
+{
+	char szPath[256];
+	snprintf(szPath, sizeof(szPath), "checkpoint_%d_%d_%d.bin", targetSolve.nTargetID, targetSolve.nInterestLevel, targetSolve.nFavor);
+	return szPath;
+}
+
+// Writes to a temporary file first and renames it over the checkpoint, so a process dying mid write leaves the previous checkpoint intact
+static bool WriteCheckpoint(const std::string& sPath, const SKnowledgeTable& knowledgeTable, const std::vector<int>& vKnowledgeOrder, uint64_t nCombinationsDone,
+	const STargetSolve* pTargetSolves, int nNumCells)
+{
+	const std::string sTempPath = sPath + ".tmp";
+	FILE* pFile = fopen(sTempPath.c_str(), "wb");
+	if (pFile == nullptr)
+	{
+		printf("Failed to open checkpoint file for writing: %s\n", sTempPath.c_str());
+		return false;
+	}
+
+	bool bWritten = true;
+	uint64_t nChecksum = 14695981039346656037ull;
+	auto Write = [&](const void* pData, size_t zSize)
+	{
+		bWritten = bWritten && (zSize == 0 || fwrite(pData, zSize, 1, pFile) == 1);
+		nChecksum = GetCheckpointChecksum(nChecksum, pData, zSize);
+	};
+
+	const int32_t nVersion = g_Env.nResultsVersion;
+	const int32_t nNumKnowledge = static_cast<int32_t>(vKnowledgeOrder.size());
+	const int32_t nCells = nNumCells;
+	Write(&s_nCheckpointMagic, sizeof(s_nCheckpointMagic));
+	Write(&nVersion, sizeof(nVersion));
+	Write(&nCombinationsDone, sizeof(nCombinationsDone));
+	Write(&nNumKnowledge, sizeof(nNumKnowledge));
+	for (int nKnowledge : vKnowledgeOrder)
+	{
+		const TKnowledgeID nKnowledgeID = knowledgeTable.vIDs[nKnowledge];
+		Write(&nKnowledgeID, sizeof(nKnowledgeID));
+	}
+
+	Write(&nCells, sizeof(nCells));
+	for (int nCell = 0 ; nCell < nNumCells ; ++nCell)
+	{
+		const STargetSolve& targetSolve = pTargetSolves[nCell];
+		const int32_t aCell[3] = { targetSolve.nTargetID, targetSolve.nInterestLevel, targetSolve.nFavor };
+		Write(aCell, sizeof(aCell));
+		for (const auto& vGoalBest : targetSolve.bestCombinations.aBestCombinations)
+		{
+			for (const SBestCombinations::SBestCombination& best : vGoalBest)
+			{
+				const int32_t nNumSlots = static_cast<int32_t>(best.vKnowledge.size());
+				Write(&best.fStrictEV, sizeof(best.fStrictEV));
+				Write(&best.fSuccessPercentage, sizeof(best.fSuccessPercentage));
+				Write(&nNumSlots, sizeof(nNumSlots));
+				Write(best.vKnowledge.data(), best.vKnowledge.size() * sizeof(TKnowledgeID));
+			}
+		}
+	}
+	const uint64_t nWrittenChecksum = nChecksum;
+	Write(&nWrittenChecksum, sizeof(nWrittenChecksum));
+
+	bWritten = (fclose(pFile) == 0) && bWritten;
+	if (!bWritten)
+	{
+		printf("Failed to write checkpoint file: %s\n", sTempPath.c_str());
+		remove(sTempPath.c_str());
+		return false;
+	}
+
+#if defined(_WIN32)
+	const bool bRenamed = (MoveFileExA(sTempPath.c_str(), sPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != FALSE);
+#else
+	const bool bRenamed = (rename(sTempPath.c_str(), sPath.c_str()) == 0);
+#endif // defined(_WIN32)
+	if (!bRenamed)
+	{
+		printf("Failed to replace checkpoint file: %s\n", sPath.c_str());
+		return false;
+	}
+
+	printf("Checkpointed after %llu combinations: %s\n", static_cast<unsigned long long>(nCombinationsDone), sPath.c_str());
+	return true;
+}
+
+// Reads a checkpoint of the same cells, the knowledge order it was enumerated in replaces vKnowledgeOrder and its best combinations are merged into
+// the target solves. Checkpoints of other results versions or knowledge, past the solve's nNumCombinations or failing their checksum are refused.
+static bool ReadCheckpoint(const std::string& sPath, const SKnowledgeTable& knowledgeTable, uint64_t nNumCombinations, std::vector<int>& vKnowledgeOrder, uint64_t& nCombinationsDone,
+	STargetSolve* pTargetSolves, int nNumCells)
+{
+	FILE* pFile = fopen(sPath.c_str(), "rb");
+	if (pFile == nullptr)
+	{
+		printf("No checkpoint to resume from: %s\n", sPath.c_str());
+		return false;
+	}
+
+	bool bRead = true;
+	uint64_t nChecksum = 14695981039346656037ull;
+	auto Read = [&](void* pData, size_t zSize)
+	{
+		bRead = bRead && (zSize == 0 || fread(pData, zSize, 1, pFile) == 1);
+		nChecksum = GetCheckpointChecksum(nChecksum, pData, zSize);
+	};
+
+	uint32_t nMagic = 0;
+	int32_t nVersion = 0;
+	uint64_t nCheckpointCombinationsDone = 0;
+	int32_t nNumKnowledge = 0;
+	Read(&nMagic, sizeof(nMagic));
+	Read(&nVersion, sizeof(nVersion));
+	Read(&nCheckpointCombinationsDone, sizeof(nCheckpointCombinationsDone));
+	Read(&nNumKnowledge, sizeof(nNumKnowledge));
+	if (!bRead || nMagic != s_nCheckpointMagic || nVersion != g_Env.nResultsVersion || nNumKnowledge != knowledgeTable.GetNumKnowledge() ||
+		nCheckpointCombinationsDone > nNumCombinations)
+	{
+		printf("Checkpoint doesn't match this solve, ignoring it: %s\n", sPath.c_str());
+		fclose(pFile);
+		return false;
+	}
+
+	std::vector<int> vCheckpointOrder(nNumKnowledge);
+	std::vector<bool> vSeen(nNumKnowledge, false);
+	for (int& nKnowledge : vCheckpointOrder)
+	{
+		TKnowledgeID nKnowledgeID = 0;
+		Read(&nKnowledgeID, sizeof(nKnowledgeID));
+		nKnowledge = bRead ? knowledgeTable.GetIndex(nKnowledgeID) : -1;
+		if (nKnowledge < 0 || vSeen[nKnowledge])
+		{
+			bRead = false;
+			break;
+		}
+		vSeen[nKnowledge] = true;
+	}
+
+	int32_t nCells = 0;
+	Read(&nCells, sizeof(nCells));
+	bRead = bRead && (nCells == nNumCells);
+
+	std::vector<STargetSolve> vCheckpointSolves(pTargetSolves, pTargetSolves + nNumCells);
+	for (int nCell = 0 ; nCell < nNumCells && bRead ; ++nCell)
+	{
+		STargetSolve& targetSolve = vCheckpointSolves[nCell];
+		int32_t aCell[3] = {};
+		Read(aCell, sizeof(aCell));
+		bRead = bRead && (aCell[0] == targetSolve.nTargetID && aCell[1] == targetSolve.nInterestLevel && aCell[2] == targetSolve.nFavor);
+		for (auto& vGoalBest : targetSolve.bestCombinations.aBestCombinations)
+		{
+			for (SBestCombinations::SBestCombination& best : vGoalBest)
+			{
+				int32_t nNumSlots = 0;
+				Read(&best.fStrictEV, sizeof(best.fStrictEV));
+				Read(&best.fSuccessPercentage, sizeof(best.fSuccessPercentage));
+				Read(&nNumSlots, sizeof(nNumSlots));
+				bRead = bRead && (nNumSlots >= 0 && nNumSlots <= MAX_CONSTELLATION_SLOTS);
+				best.vKnowledge.resize(bRead ? nNumSlots : 0);
+				Read(best.vKnowledge.data(), best.vKnowledge.size() * sizeof(TKnowledgeID));
+			}
+		}
+	}
+	const uint64_t nReadChecksum = nChecksum;
+	uint64_t nStoredChecksum = 0;
+	Read(&nStoredChecksum, sizeof(nStoredChecksum));
+	bRead = bRead && (nStoredChecksum == nReadChecksum);
+	fclose(pFile);
+
+	if (!bRead)
+	{
+		printf("Checkpoint doesn't match this solve, ignoring it: %s\n", sPath.c_str());
+		return false;
+	}
+
+	for (int nCell = 0 ; nCell < nNumCells ; ++nCell)
+	{
+		MergeBestCombinations(pTargetSolves[nCell].bestCombinations, vCheckpointSolves[nCell].bestCombinations);
+	}
+	vKnowledgeOrder = vCheckpointOrder;
+	nCombinationsDone = nCheckpointCombinationsDone;
+	return true;
+}
+
+// Full solve of every target state in pTargetSolves at once, each combination and permutation is enumerated once for all of them
+static bool SimulateCombinationsOnCells(const STarget& target, STargetSolve* pTargetSolves, int nNumCells)
+{
+	auto itConstellation = g_Env.mapConstellations.find(target.nConstellationID);
+	if (itConstellation == g_Env.mapConstellations.end())
+	{
+		printf("Failed to find constellation: %d\n", target.nConstellationID);
+		return false;
+	}
+	const SConstellation& constellation = itConstellation->second;
+
+	if (constellation.nNumSlots > MAX_CONSTELLATION_SLOTS)
+	{
+		printf("Constellation %d has too many slots: %d (max %d)\n", constellation.nID, constellation.nNumSlots, MAX_CONSTELLATION_SLOTS);
+		return false;
+	}
+
+	if (static_cast<int>(constellation.vSlotOrder.size()) != constellation.nNumSlots)
+	{
+		printf("Constellation %d slot order doesn't match its slot count: %d vs. %d\n", constellation.nID, static_cast<int>(constellation.vSlotOrder.size()), constellation.nNumSlots);
+		return false;
+	}
+
+	auto itCategory = g_Env.mapKnowledgeCategories.find(target.nKnowledgeCategoryID);
+	if (itCategory == g_Env.mapKnowledgeCategories.end())
+	{
+		printf("Failed to find knowledge category: %d\n", target.nKnowledgeCategoryID);
+		return false;
+	}
+	const auto& category = itCategory->second;
+
+	if (category.vKnowledge.empty())
+	{
+		printf("Refusing to simulate, category has no knowledge\n");
+		return false;
+	}
+
+	// Grid cells are picked from whatever is unsolved at the time, so only single cell solves can be picked up again
+	SSolveProgress progress;
+	progress.bCheckpoint = (g_Env.fCheckpointTime > 0.0 && nNumCells == 1);
+	SKnowledgeTable knowledgeTable;
+	if (!knowledgeTable.Build(category))
+	{
+		return false;
+	}
+
+	printf("Simulating knowledge combinations for:\n- Target: %s\n- Knowledge category: %d\n- Constellation: %d\n", target.sName.c_str(), target.nKnowledgeCategoryID, target.nConstellationID);
+	if (nNumCells > 1)
+	{
+		printf("- Interest/favor grid cells: %d\n", nNumCells);
+	}
+
+	// Every thread keeps its own best combinations, they're merged once all combinations are done
+	struct SSolveThread
+	{
+		std::vector<STargetSolve> vTargetSolves;
+		std::array<SCombinationResult, SIMULATION_BATCH_LANES> aResults;
+		size_t zPermutations = 0;
+		size_t zPrunedPermutations = 0;
+	};
+	const int nNumThreads = GetNumSolveThreads();
+	std::vector<SSolveThread> vSolveThreads(nNumThreads);
+	printf("Solving on %d threads\n", nNumThreads);
+
+	// Cells of a grid are close together, the first one decides which combinations are promising. A resumed solve keeps the order of the run it resumes,
+	// its best combinations are merged in before the threads take their copies.
+	std::vector<int> vKnowledgeOrder;
+	GetSolveKnowledgeOrder(vKnowledgeOrder, knowledgeTable, pTargetSolves[0].nInterestLevel, pTargetSolves[0].nFavor);
+	const std::string sCheckpointPath = GetCheckpointPath(pTargetSolves[0]);
+	if (progress.bCheckpoint && g_Env.bResumeSolves)
+	{
+		ReadCheckpoint(sCheckpointPath, knowledgeTable, GetNumCombinations(knowledgeTable.GetNumKnowledge(), constellation.nNumSlots), vKnowledgeOrder, progress.nCombinationsDone,
+			pTargetSolves, nNumCells);
+	}
+	for (SSolveThread& solveThread : vSolveThreads)
+	{
+		solveThread.vTargetSolves.assign(pTargetSolves, pTargetSolves + nNumCells);
+	}
+
+	auto Checkpoint = [&](uint64_t nCombinationsDone)
+	{
+		std::vector<STargetSolve> vCheckpointSolves(pTargetSolves, pTargetSolves + nNumCells);
+		for (const SSolveThread& solveThread : vSolveThreads)
+		{
+			for (int nCell = 0 ; nCell < nNumCells ; ++nCell)
+			{
+				MergeBestCombinations(vCheckpointSolves[nCell].bestCombinations, solveThread.vTargetSolves[nCell].bestCombinations);
+			}
+		}
+		WriteCheckpoint(sCheckpointPath, knowledgeTable, vKnowledgeOrder, nCombinationsDone, vCheckpointSolves.data(), nNumCells);
+	};
+
+	const bool bSolved = SimulateCombinationsOnThreads(knowledgeTable, constellation, vKnowledgeOrder, nNumThreads, progress, [&](int nThread, const int* pCombination)
+	{
+		SSolveThread& solveThread = vSolveThreads[nThread];
+		SPermutationTrie trie(constellation, knowledgeTable, pCombination, solveThread.vTargetSolves.data(), nNumCells);
+		SimulatePermutationTrie(trie, solveThread.aResults.data(), 0, 0);
+		solveThread.zPermutations += trie.zNumPermutations;
+		solveThread.zPrunedPermutations += trie.zNumPrunedPermutations;
+	}, Checkpoint);
+	if (!bSolved)
+	{
+		return false;
+	}
+
+	size_t zPermutations = 0;
+	size_t zPrunedPermutations = 0;
+	for (const SSolveThread& solveThread : vSolveThreads)
+	{
+		for (int nCell = 0 ; nCell < nNumCells ; ++nCell)
+		{
+			MergeBestCombinations(pTargetSolves[nCell].bestCombinations, solveThread.vTargetSolves[nCell].bestCombinations);
+			pTargetSolves[nCell].bProvisional = progress.bOutOfTime;
+		}
+		zPermutations += solveThread.zPermutations;
+		zPrunedPermutations += solveThread.zPrunedPermutations;
+	}
+	printf("Total number of permutations simulated: %zd\n", zPermutations);
+	if (g_Env.bPrunePermutations)
+	{
+		printf("Total number of permutations pruned: %zd (%.2f%%)\n", zPrunedPermutations,
+			static_cast<double>(zPrunedPermutations) / std::max<size_t>(zPermutations + zPrunedPermutations, 1) * 100.0f);
+	}
+
+	// Out of time solves keep theirs for the solve that finishes them
+	if (progress.bCheckpoint && !progress.bOutOfTime)
+	{
+		remove(sCheckpointPath.c_str());
+	}
+
+	return true;
+}
+
+bool SimulateCombinations(const STarget& target, STargetSolve& targetSolve)
+{
+	return SimulateCombinationsOnCells(target, &targetSolve, 1);
+}
+
+bool SimulateCombinationsGrid(const STarget& target, std::vector<STargetSolve>& vTargetSolves)
+{
+	if (vTargetSolves.empty())
+	{
+		printf("Refusing to simulate, no interest/favor grid cells to solve\n");
+		return false;
+	}
 
-	SimulateHelper(result, status, constellation, vSlots, 0);
+	return SimulateCombinationsOnCells(target, vTargetSolves.data(), static_cast<int>(vTargetSolves.size()));
 }
 
-bool SimulateCombinations(const STarget& target, STargetSolve& targetSolve)
+static bool SeedBestCombinationsOnCells(const STarget& target, STargetSolve* pTargetSolves, int nNumCells, const std::vector<std::vector<TKnowledgeID>>& vSeedPermutations)
 {
 	auto itConstellation = g_Env.mapConstellations.find(target.nConstellationID);
 	if (itConstellation == g_Env.mapConstellations.end())
@@ -258,107 +2223,84 @@ bool SimulateCombinations(const STarget& target, STargetSolve& targetSolve)
 	}
 	const SConstellation& constellation = itConstellation->second;
 
+	if (constellation.nNumSlots > MAX_CONSTELLATION_SLOTS)
+	{
+		printf("Constellation %d has too many slots: %d (max %d)\n", constellation.nID, constellation.nNumSlots, MAX_CONSTELLATION_SLOTS);
+		return false;
+	}
+
+	if (static_cast<int>(constellation.vSlotOrder.size()) != constellation.nNumSlots)
+	{
+		printf("Constellation %d slot order doesn't match its slot count: %d vs. %d\n", constellation.nID, static_cast<int>(constellation.vSlotOrder.size()), constellation.nNumSlots);
+		return false;
+	}
+
 	auto itCategory = g_Env.mapKnowledgeCategories.find(target.nKnowledgeCategoryID);
 	if (itCategory == g_Env.mapKnowledgeCategories.end())
 	{
 		printf("Failed to find knowledge category: %d\n", target.nKnowledgeCategoryID);
 		return false;
 	}
-	const auto& category = itCategory->second;
 
-	if (category.vKnowledge.empty())
+	SKnowledgeTable knowledgeTable;
+	if (!knowledgeTable.Build(itCategory->second))
 	{
-		printf("Refusing to simulate, category has no knowledge\n");
 		return false;
 	}
 
-	printf("Generating knowledge combinations for:\n- Target: %s\n- Knowledge category: %d\n- Constellation: %d\n", target.sName.c_str(), target.nKnowledgeCategoryID, target.nConstellationID);
-	{
-		const int nNumCombinations = static_cast<int>(std::tgamma<size_t>(category.vKnowledge.size() + 1) / std::tgamma<size_t>((category.vKnowledge.size() - constellation.nNumSlots) + 1)) + 1;
-		printf("Reserving space for %d combinations (%d total knowledge IDs)\n", nNumCombinations, nNumCombinations * constellation.nNumSlots);
-		CMemory<TKnowledgeID>::Init(nNumCombinations * constellation.nNumSlots);
-	}
-	auto vKnowledgeCombinations = GenerateCombinationsAndPermutationsStaticMemory<TKnowledgeID, true>(category.vKnowledge, constellation.nNumSlots);
-	printf("Generated %d combinations, beginning simulations\n", static_cast<int>(vKnowledgeCombinations.size()));
-	
+	// Seeds are scored exactly like the solver scores them, so they only ever stand in for a permutation the solve would have found anyway
+	int nNumSeeded = 0;
 	SCombinationResult result;
-
-	clock_t nSimStartTime = clock();
-	clock_t nLastPrintTime = 0;
-	for (int nKnowledgeCombination = 0 ; nKnowledgeCombination < static_cast<int>(vKnowledgeCombinations.size()) ; ++nKnowledgeCombination)
+	std::array<int, MAX_CONSTELLATION_SLOTS> aKnowledgeSlots;
+	for (const std::vector<TKnowledgeID>& vPermutation : vSeedPermutations)
 	{
-		int nCurrentTime = clock();
-		if (nLastPrintTime == 0 || static_cast<double>(nCurrentTime - nLastPrintTime) / CLOCKS_PER_SEC >= g_Env.fSolvePrintTime)
+		if (static_cast<int>(vPermutation.size()) != constellation.nNumSlots)
 		{
-			printf("Beginning simulation %d (%.2f%%) - %.3fs elapsed\n", nKnowledgeCombination, static_cast<double>(nKnowledgeCombination) / vKnowledgeCombinations.size() * 100.0f,
-				static_cast<double>(nCurrentTime - nSimStartTime) / CLOCKS_PER_SEC);
-			nLastPrintTime = nCurrentTime;
+			continue;
 		}
 
-		const auto& pKnowledgeCombination = vKnowledgeCombinations[nKnowledgeCombination];
-		result.Clear();
-
-		std::vector<SKnowledge> vKnowledgeSlots(constellation.nNumSlots);
-		for (int nKnowledgeIDIndex = 0 ; nKnowledgeIDIndex < vKnowledgeSlots.size() ; ++nKnowledgeIDIndex)
+		bool bValid = true;
+		for (int nSlot = 0 ; nSlot < constellation.nNumSlots && bValid ; ++nSlot)
 		{
-			const int nKnowledgeID = pKnowledgeCombination[nKnowledgeIDIndex];
-			auto itKnowledge = g_Env.mapKnowledges.find(nKnowledgeID);
-			if (itKnowledge == g_Env.mapKnowledges.end())
-			{
-				printf("Failed to find knowledge: %d\n", nKnowledgeID);
-				return false;
-			}
-			SKnowledge& knowledge = itKnowledge->second;
-			vKnowledgeSlots[nKnowledgeIDIndex] = knowledge;
+			aKnowledgeSlots[nSlot] = knowledgeTable.GetIndex(vPermutation[nSlot]);
+			bValid = (aKnowledgeSlots[nSlot] >= 0 && std::find(vPermutation.begin(), vPermutation.begin() + nSlot, vPermutation[nSlot]) == vPermutation.begin() + nSlot);
 		}
-
-		Simulate(result, targetSolve.nInterestLevel, targetSolve.nFavor, constellation, vKnowledgeSlots);
-		
-		for (int nGoal = 0 ; nGoal < NUM_GOALS ; ++nGoal)
+		if (!bValid)
 		{
-			const EGoal eGoal = static_cast<EGoal>(nGoal);
-
-			auto& vTargetBest = targetSolve.bestCombinations.aBestCombinations[nGoal];
-			auto& vResultBest = result.bestCombinationStats.aBestCombinations[nGoal];
-
-			const int nNumGoalParams = static_cast<int>(vTargetBest.size());
-			for (int nGoalParam = 0 ; nGoalParam < nNumGoalParams ; ++nGoalParam)
-			{
-				auto& targetBest = vTargetBest[nGoalParam];
-				auto& resultBest = vResultBest[nGoalParam];
-
-				resultBest.fStrictEV *= resultBest.fSuccessPercentage;
-				bool bReplaceBest = (targetBest.vKnowledge.empty());
-				if (!bReplaceBest)
-				{
-					const double fSuccessDeltaEV = (targetBest.fSuccessPercentage - resultBest.fSuccessPercentage) * g_Env.fDeltaSuccessEVMultiplier;
-					if (resultBest.fStrictEV > (targetBest.fStrictEV + fSuccessDeltaEV))
-					{
-						bReplaceBest = true;
-					}
-				}
+			continue;
+		}
 
-				if (bReplaceBest)
-				{
-					targetBest.fStrictEV = resultBest.fStrictEV;
-					targetBest.fSuccessPercentage = resultBest.fSuccessPercentage;
-					targetBest.vKnowledge.resize(vKnowledgeSlots.size());
-					for (int nKnowledgeIDIndex = 0 ; nKnowledgeIDIndex < vKnowledgeSlots.size() ; ++nKnowledgeIDIndex)
-					{
-						const int nKnowledgeID = vKnowledgeSlots[nKnowledgeIDIndex].nID;
-						targetBest.vKnowledge[nKnowledgeIDIndex] = nKnowledgeID;
-					}
-				}
-			}
+		for (int nCell = 0 ; nCell < nNumCells ; ++nCell)
+		{
+			STargetSolve& targetSolve = pTargetSolves[nCell];
+			result.Clear();
+			Simulate(result, targetSolve.nInterestLevel, targetSolve.nFavor, constellation, knowledgeTable, aKnowledgeSlots.data(), constellation.nNumSlots);
+			UpdateBestCombinations(targetSolve.bestCombinations, result, vPermutation.data(), constellation.nNumSlots);
 		}
+		++nNumSeeded;
 	}
+	printf("Seeded best combinations from %d of %d stored permutations\n", nNumSeeded, static_cast<int>(vSeedPermutations.size()));
 
 	return true;
 }
 
-static void SimulateCombinationsFastGoal(EGoal eGoal, SCombinationResult& result, STargetSolve& targetSolve, const SConstellation& constellation, std::vector<SKnowledge> vKnowledgeSlots)
+bool SeedBestCombinations(const STarget& target, STargetSolve& targetSolve, const std::vector<std::vector<TKnowledgeID>>& vSeedPermutations)
 {
-	result.Clear();
+	return SeedBestCombinationsOnCells(target, &targetSolve, 1, vSeedPermutations);
+}
+
+bool SeedBestCombinationsGrid(const STarget& target, std::vector<STargetSolve>& vTargetSolves, const std::vector<std::vector<TKnowledgeID>>& vSeedPermutations)
+{
+	return SeedBestCombinationsOnCells(target, vTargetSolves.data(), static_cast<int>(vTargetSolves.size()), vSeedPermutations);
+}
+
+// Fills pKnowledgeSlots with the permutation of the combination the fast solver simulates for the given goal
+static void ArrangeFastGoalPermutation(EGoal eGoal, const STargetSolve& targetSolve, const SKnowledgeTable& knowledgeTable, const int* pCombination, int nNumSlots, int* pKnowledgeSlots)
+{
+	std::array<int, MAX_CONSTELLATION_SLOTS> aKnowledgeSlots;
+	std::copy(pCombination, pCombination + nNumSlots, aKnowledgeSlots.begin());
+	const auto itSlotsBegin = aKnowledgeSlots.begin();
+	const auto itSlotsEnd = aKnowledgeSlots.begin() + nNumSlots;
 
 	// Sort knowledge to approximate a best permutation for the given goal - these are heuristics that I thought should work, but there may be better solutions
 	switch (eGoal)
@@ -367,23 +2309,23 @@ static void SimulateCombinationsFastGoal(EGoal eGoal, SCombinationResult& result
 	case GOAL_SPARK_FAILURE:
 	case GOAL_ACCUMULATED_FAVOR:
 	case GOAL_FREE_TALK:
-		std::sort(vKnowledgeSlots.begin(), vKnowledgeSlots.end(),
-			[&targetSolve](const SKnowledge& lhs, const SKnowledge& rhs)
+		std::sort(itSlotsBegin, itSlotsEnd,
+			[&targetSolve, &knowledgeTable](int nLHS, int nRHS)
 			{	
-				const double fSparkChanceLHS = std::min(lhs.fInterest / std::max(static_cast<double>(targetSolve.nInterestLevel), DBL_EPSILON), 1.0);
-				const double fSparkChanceRHS = std::min(rhs.fInterest / std::max(static_cast<double>(targetSolve.nInterestLevel), DBL_EPSILON), 1.0);
+				const double fSparkChanceLHS = std::min(knowledgeTable.vInterest[nLHS] / std::max(static_cast<double>(targetSolve.nInterestLevel), DBL_EPSILON), 1.0);
+				const double fSparkChanceRHS = std::min(knowledgeTable.vInterest[nRHS] / std::max(static_cast<double>(targetSolve.nInterestLevel), DBL_EPSILON), 1.0);
 
-				return (lhs.nAverageFavor * fSparkChanceLHS) > (rhs.nAverageFavor * fSparkChanceRHS);
+				return (knowledgeTable.vAverageFavor[nLHS] * fSparkChanceLHS) > (knowledgeTable.vAverageFavor[nRHS] * fSparkChanceRHS);
 			}
 		);
 		break;
 
 	case GOAL_MAX_FAVOR:
-		std::sort(vKnowledgeSlots.begin(), vKnowledgeSlots.end(),
-			[&targetSolve](const SKnowledge& lhs, const SKnowledge& rhs)
+		std::sort(itSlotsBegin, itSlotsEnd,
+			[&targetSolve, &knowledgeTable](int nLHS, int nRHS)
 			{	
-				const double fSparkChanceLHS = std::min(lhs.fInterest / std::max(static_cast<double>(targetSolve.nInterestLevel), DBL_EPSILON), 1.0);
-				const double fSparkChanceRHS = std::min(rhs.fInterest / std::max(static_cast<double>(targetSolve.nInterestLevel), DBL_EPSILON), 1.0);
+				const double fSparkChanceLHS = std::min(knowledgeTable.vInterest[nLHS] / std::max(static_cast<double>(targetSolve.nInterestLevel), DBL_EPSILON), 1.0);
+				const double fSparkChanceRHS = std::min(knowledgeTable.vInterest[nRHS] / std::max(static_cast<double>(targetSolve.nInterestLevel), DBL_EPSILON), 1.0);
 
 				return fSparkChanceLHS > fSparkChanceRHS;
 			}
@@ -393,20 +2335,20 @@ static void SimulateCombinationsFastGoal(EGoal eGoal, SCombinationResult& result
 	case GOAL_CONSECUTIVE_SPARK:
 	{
 		// Middle out
-		auto vSorted = vKnowledgeSlots;
-		std::sort(vSorted.begin(), vSorted.end(),
-			[&targetSolve](const SKnowledge& lhs, const SKnowledge& rhs)
+		auto aSorted = aKnowledgeSlots;
+		std::sort(aSorted.begin(), aSorted.begin() + nNumSlots,
+			[&targetSolve, &knowledgeTable](int nLHS, int nRHS)
 			{	
-				const double fSparkChanceLHS = std::min(lhs.fInterest / std::max(static_cast<double>(targetSolve.nInterestLevel), DBL_EPSILON), 1.0);
-				const double fSparkChanceRHS = std::min(rhs.fInterest / std::max(static_cast<double>(targetSolve.nInterestLevel), DBL_EPSILON), 1.0);
+				const double fSparkChanceLHS = std::min(knowledgeTable.vInterest[nLHS] / std::max(static_cast<double>(targetSolve.nInterestLevel), DBL_EPSILON), 1.0);
+				const double fSparkChanceRHS = std::min(knowledgeTable.vInterest[nRHS] / std::max(static_cast<double>(targetSolve.nInterestLevel), DBL_EPSILON), 1.0);
 
 				return fSparkChanceLHS > fSparkChanceRHS;
 			}
 		);
 
-		for (int nSortedIndex = 0 ; nSortedIndex < vSorted.size() ; ++nSortedIndex)
+		for (int nSortedIndex = 0 ; nSortedIndex < nNumSlots ; ++nSortedIndex)
 		{
-			int nResultIndex = static_cast<int>(vKnowledgeSlots.size() / 2);
+			int nResultIndex = nNumSlots / 2;
 			if ((nSortedIndex % 2) == 1)
 			{
 				nResultIndex -= (nSortedIndex + 1) / 2;
@@ -415,27 +2357,27 @@ static void SimulateCombinationsFastGoal(EGoal eGoal, SCombinationResult& result
 			{
 				nResultIndex += (nSortedIndex + 1) / 2;
 			}
-			vKnowledgeSlots[nResultIndex] = vSorted[nSortedIndex];
+			aKnowledgeSlots[nResultIndex] = aSorted[nSortedIndex];
 		}
 	}
 		break;
 
 	case GOAL_CONSECUTIVE_SPARK_FAILURE:
 		// Middle out
-		auto vSorted = vKnowledgeSlots;
-		std::sort(vSorted.begin(), vSorted.end(),
-			[&targetSolve](const SKnowledge& lhs, const SKnowledge& rhs)
+		auto aSorted = aKnowledgeSlots;
+		std::sort(aSorted.begin(), aSorted.begin() + nNumSlots,
+			[&targetSolve, &knowledgeTable](int nLHS, int nRHS)
 			{	
-				const double fSparkChanceLHS = std::min(lhs.fInterest / std::max(static_cast<double>(targetSolve.nInterestLevel), DBL_EPSILON), 1.0);
-				const double fSparkChanceRHS = std::min(rhs.fInterest / std::max(static_cast<double>(targetSolve.nInterestLevel), DBL_EPSILON), 1.0);
+				const double fSparkChanceLHS = std::min(knowledgeTable.vInterest[nLHS] / std::max(static_cast<double>(targetSolve.nInterestLevel), DBL_EPSILON), 1.0);
+				const double fSparkChanceRHS = std::min(knowledgeTable.vInterest[nRHS] / std::max(static_cast<double>(targetSolve.nInterestLevel), DBL_EPSILON), 1.0);
 
 				return fSparkChanceLHS < fSparkChanceRHS;
 			}
 		);
 
-		for (int nSortedIndex = 0 ; nSortedIndex < vSorted.size() ; ++nSortedIndex)
+		for (int nSortedIndex = 0 ; nSortedIndex < nNumSlots ; ++nSortedIndex)
 		{
-			int nResultIndex = static_cast<int>(vKnowledgeSlots.size() / 2);
+			int nResultIndex = nNumSlots / 2;
 			if ((nSortedIndex % 2) == 1)
 			{
 				nResultIndex -= (nSortedIndex + 1) / 2;
@@ -444,44 +2386,33 @@ static void SimulateCombinationsFastGoal(EGoal eGoal, SCombinationResult& result
 			{
 				nResultIndex += (nSortedIndex + 1) / 2;
 			}
-			vKnowledgeSlots[nResultIndex] = vSorted[nSortedIndex];
+			aKnowledgeSlots[nResultIndex] = aSorted[nSortedIndex];
 		}
 		break;
 	}
 
-	Simulate(result, targetSolve.nInterestLevel, targetSolve.nFavor, constellation, vKnowledgeSlots);
-		
+	std::copy(itSlotsBegin, itSlotsEnd, pKnowledgeSlots);
+}
+
+// Offers the goal's permutation result to every goal param of the goal
+static void UpdateFastGoalBest(EGoal eGoal, SCombinationResult& result, STargetSolve& targetSolve, const SKnowledgeTable& knowledgeTable, const int* pKnowledgeSlots, int nNumSlots)
+{
+	std::array<TKnowledgeID, MAX_CONSTELLATION_SLOTS> aKnowledgeIDs;
+	for (int nKnowledgeIDIndex = 0 ; nKnowledgeIDIndex < nNumSlots ; ++nKnowledgeIDIndex)
+	{
+		aKnowledgeIDs[nKnowledgeIDIndex] = knowledgeTable.vIDs[pKnowledgeSlots[nKnowledgeIDIndex]];
+	}
+
 	auto& vTargetBest = targetSolve.bestCombinations.aBestCombinations[eGoal];
 	auto& vResultBest = result.bestCombinationStats.aBestCombinations[eGoal];
 
+	// Each combination offers one permutation per goal, so ties going to the earlier combination matches walking them in order
 	const int nNumGoalParams = static_cast<int>(vTargetBest.size());
 	for (int nGoalParam = 0 ; nGoalParam < nNumGoalParams ; ++nGoalParam)
 	{
-		auto& targetBest = vTargetBest[nGoalParam];
 		auto& resultBest = vResultBest[nGoalParam];
-
 		resultBest.fStrictEV *= resultBest.fSuccessPercentage;
-		bool bReplaceBest = (targetBest.vKnowledge.empty());
-		if (!bReplaceBest)
-		{
-			const double fSuccessDeltaEV = (targetBest.fSuccessPercentage - resultBest.fSuccessPercentage) * g_Env.fDeltaSuccessEVMultiplier;
-			if (resultBest.fStrictEV > (targetBest.fStrictEV + fSuccessDeltaEV))
-			{
-				bReplaceBest = true;
-			}
-		}
-
-		if (bReplaceBest)
-		{
-			targetBest.fStrictEV = resultBest.fStrictEV;
-			targetBest.fSuccessPercentage = resultBest.fSuccessPercentage;
-			targetBest.vKnowledge.resize(vKnowledgeSlots.size());
-			for (int nKnowledgeIDIndex = 0 ; nKnowledgeIDIndex < vKnowledgeSlots.size() ; ++nKnowledgeIDIndex)
-			{
-				const int nKnowledgeID = vKnowledgeSlots[nKnowledgeIDIndex].nID;
-				targetBest.vKnowledge[nKnowledgeIDIndex] = nKnowledgeID;
-			}
-		}
+		ReplaceBestCombination(vTargetBest[nGoalParam], resultBest, aKnowledgeIDs.data(), nNumSlots);
 	}
 }
 
@@ -495,6 +2426,18 @@ bool SimulateCombinationsFast(const STarget& target, STargetSolve& targetSolve)
 	}
 	const SConstellation& constellation = itConstellation->second;
 
+	if (constellation.nNumSlots > MAX_CONSTELLATION_SLOTS)
+	{
+		printf("Constellation %d has too many slots: %d (max %d)\n", constellation.nID, constellation.nNumSlots, MAX_CONSTELLATION_SLOTS);
+		return false;
+	}
+
+	if (static_cast<int>(constellation.vSlotOrder.size()) != constellation.nNumSlots)
+	{
+		printf("Constellation %d slot order doesn't match its slot count: %d vs. %d\n", constellation.nID, static_cast<int>(constellation.vSlotOrder.size()), constellation.nNumSlots);
+		return false;
+	}
+
 	auto itCategory = g_Env.mapKnowledgeCategories.find(target.nKnowledgeCategoryID);
 	if (itCategory == g_Env.mapKnowledgeCategories.end())
 	{
@@ -509,50 +2452,68 @@ bool SimulateCombinationsFast(const STarget& target, STargetSolve& targetSolve)
 		return false;
 	}
 
-	printf("Generating knowledge combinations for:\n- Target: %s\n- Knowledge category: %d\n- Constellation: %d\n", target.sName.c_str(), target.nKnowledgeCategoryID, target.nConstellationID);
+	SSolveProgress progress;
+	SKnowledgeTable knowledgeTable;
+	if (!knowledgeTable.Build(category))
 	{
-		const int nNumCombinations = static_cast<int>(std::tgamma<size_t>(category.vKnowledge.size() + 1) / (std::tgamma<size_t>(constellation.nNumSlots + 1) * std::tgamma<size_t>((category.vKnowledge.size() - constellation.nNumSlots) + 1))) + 1;
-		printf("Reserving space for %d combinations (%d total knowledge IDs)\n", nNumCombinations, nNumCombinations * constellation.nNumSlots);
-		CMemory<TKnowledgeID>::Init(nNumCombinations * constellation.nNumSlots);
+		return false;
 	}
-	auto vKnowledgeCombinations = GenerateCombinationsAndPermutationsStaticMemory<TKnowledgeID, false>(category.vKnowledge, constellation.nNumSlots);
-	printf("Generated %d combinations, beginning simulations\n", static_cast<int>(vKnowledgeCombinations.size()));
 
-	clock_t nSimStartTime = clock();
-	clock_t nLastPrintTime = 0;
-	
-	// Find the best combinations
-	SCombinationResult result;
-	for (int nKnowledgeCombination = 0 ; nKnowledgeCombination < static_cast<int>(vKnowledgeCombinations.size()) ; ++nKnowledgeCombination)
+	printf("Simulating knowledge combinations for:\n- Target: %s\n- Knowledge category: %d\n- Constellation: %d\n", target.sName.c_str(), target.nKnowledgeCategoryID, target.nConstellationID);
+
+	// Find the best combinations, every thread keeps its own best combinations until they're merged
+	struct SSolveThread
 	{
-		int nCurrentTime = clock();
-		if (nLastPrintTime == 0 || static_cast<double>(nCurrentTime - nLastPrintTime) / CLOCKS_PER_SEC >= g_Env.fSolvePrintTime)
-		{
-			printf("Beginning simulation %d (%.2f%%) - %.3fs elapsed\n", nKnowledgeCombination, static_cast<double>(nKnowledgeCombination) / vKnowledgeCombinations.size() * 100.0f,
-				static_cast<double>(nCurrentTime - nSimStartTime) / CLOCKS_PER_SEC);
-			nLastPrintTime = nCurrentTime;
-		}
+		STargetSolve targetSolve;
+		std::array<SCombinationResult, SIMULATION_BATCH_LANES> aResults;
+		std::vector<TKnowledgeID*> vPermutations;
+		CArena* pArena = nullptr;
+		size_t zPermutations = 0;
+		bool bOutOfTime = false;
+	};
+	const int nNumThreads = GetNumSolveThreads();
+	std::vector<SSolveThread> vSolveThreads(nNumThreads);
+	for (SSolveThread& solveThread : vSolveThreads)
+	{
+		solveThread.targetSolve = targetSolve;
+	}
+	printf("Solving on %d threads\n", nNumThreads);
 
-		const auto& pKnowledgeCombination = vKnowledgeCombinations[nKnowledgeCombination];
-		std::vector<SKnowledge> vKnowledgeSlots(constellation.nNumSlots);
-		for (int nKnowledgeIDIndex = 0 ; nKnowledgeIDIndex < vKnowledgeSlots.size() ; ++nKnowledgeIDIndex)
-		{
-			const int nKnowledgeID = pKnowledgeCombination[nKnowledgeIDIndex];
-			auto itKnowledge = g_Env.mapKnowledges.find(nKnowledgeID);
-			if (itKnowledge == g_Env.mapKnowledges.end())
-			{
-				printf("Failed to find knowledge: %d\n", nKnowledgeID);
-				return false;
-			}
-			SKnowledge& knowledge = itKnowledge->second;
-			vKnowledgeSlots[nKnowledgeIDIndex] = knowledge;
-		}
+	std::vector<int> vKnowledgeOrder;
+	GetSolveKnowledgeOrder(vKnowledgeOrder, knowledgeTable, targetSolve.nInterestLevel, targetSolve.nFavor);
 
+	const bool bSolved = SimulateCombinationsOnThreads(knowledgeTable, constellation, vKnowledgeOrder, nNumThreads, progress, [&](int nThread, const int* pCombination)
+	{
+		SSolveThread& solveThread = vSolveThreads[nThread];
+		const int nNumSlots = constellation.nNumSlots;
+
+		// One permutation per goal, each only simulated for its own goal
+		std::array<int, MAX_CONSTELLATION_SLOTS> aPermutation;
 		for (int nGoal = 0 ; nGoal < NUM_GOALS ; ++nGoal)
 		{
 			const EGoal eGoal = static_cast<EGoal>(nGoal);
-			SimulateCombinationsFastGoal(eGoal, result, targetSolve, constellation, vKnowledgeSlots);
+			SCombinationResult& result = solveThread.aResults[0];
+			ArrangeFastGoalPermutation(eGoal, solveThread.targetSolve, knowledgeTable, pCombination, nNumSlots, aPermutation.data());
+			result.ClearGoal(eGoal);
+			SimulateGoal(eGoal, result, targetSolve.nInterestLevel, targetSolve.nFavor, constellation, knowledgeTable, aPermutation.data(), nNumSlots);
+			UpdateFastGoalBest(eGoal, result, solveThread.targetSolve, knowledgeTable, aPermutation.data(), nNumSlots);
 		}
+	}, [](uint64_t) {});
+	if (!bSolved)
+	{
+		return false;
+	}
+
+	for (const SSolveThread& solveThread : vSolveThreads)
+	{
+		MergeBestCombinations(targetSolve.bestCombinations, solveThread.targetSolve.bestCombinations);
+	}
+	targetSolve.bProvisional = progress.bOutOfTime;
+
+	// Every goal param already has a permutation from the first pass, reordering them is skipped once out of time
+	if (progress.bOutOfTime)
+	{
+		return true;
 	}
 
 	/*struct SPermutationResult
@@ -664,75 +2625,320 @@ bool SimulateCombinationsFast(const STarget& target, STargetSolve& targetSolve)
 		}
 	}
 	
-	size_t zPermutations = 0;
+	// Each goal param belongs to exactly one unique combination, so threads working on different combinations never touch the same result
+	std::vector<const std::pair<const std::vector<TKnowledgeID>, std::vector<SThing>>*> vUniqueCombinations;
 	for (const auto& itCombination : mapUniqueCombinations)
 	{
-		auto& vKnowledge = itCombination.first;
-		auto& vThings = itCombination.second;
+		vUniqueCombinations.push_back(&itCombination);
+	}
+
+	ResetSolveArenas();
+	for (int nThread = 0 ; nThread < nNumThreads ; ++nThread)
+	{
+		vSolveThreads[nThread].zPermutations = 0;
+		vSolveThreads[nThread].pArena = &GetSolveArena(nThread);
+	}
 
-		int nCurrentTime = clock();
-		if (nLastPrintTime == 0 || static_cast<double>(nCurrentTime - nLastPrintTime) / CLOCKS_PER_SEC >= g_Env.fSolvePrintTime)
+	// One thread failing stops the others at their next combination
+	const int64_t nNumUniqueCombinations = static_cast<int64_t>(vUniqueCombinations.size());
+	std::atomic<int64_t> nUniqueCombinationsDone(0);
+	std::atomic<bool> bFailed(false);
+	CSolvePrintTimer printTimer;
+	ParallelForChunks(0, nNumUniqueCombinations, 1, nNumThreads, [&](int nThread, int64_t nChunkBegin, int64_t nChunkEnd)
+	{
+		SSolveThread& solveThread = vSolveThreads[nThread];
+		double fElapsedTime = 0.0;
+		if (printTimer.IsPrintDue(fElapsedTime))
 		{
-			printf("Doing stuff - %.3fs elapsed\n", 
-				static_cast<double>(nCurrentTime - nSimStartTime) / CLOCKS_PER_SEC);
-			nLastPrintTime = nCurrentTime;
+			const int64_t nDone = nUniqueCombinationsDone.load();
+			printf("Doing stuff - %lld of %lld combinations (%.2f%%) - %.3fs elapsed\n", static_cast<long long>(nDone), static_cast<long long>(nNumUniqueCombinations),
+				static_cast<double>(nDone) / nNumUniqueCombinations * 100.0f, fElapsedTime);
 		}
 
-		std::vector<std::vector<TKnowledgeID>> vPermutations;
-		GeneratePermutations(vPermutations, vKnowledge);
-
-		for (int nPermutationIndex = 0 ; nPermutationIndex < vPermutations.size() ; ++nPermutationIndex)
+		for (int64_t nUniqueCombination = nChunkBegin ; nUniqueCombination < nChunkEnd && !bFailed ; ++nUniqueCombination)
 		{
-			auto& vPermutation = vPermutations[nPermutationIndex];
-			++zPermutations;
+			if (IsSolveOutOfTime(progress.solveStartTime))
+			{
+				solveThread.bOutOfTime = true;
+				break;
+			}
+
+			auto& vKnowledge = vUniqueCombinations[nUniqueCombination]->first;
+			auto& vThings = vUniqueCombinations[nUniqueCombination]->second;
 
-			std::vector<SKnowledge> vKnowledgeSlots(constellation.nNumSlots);
-			for (int nKnowledgeIDIndex = 0 ; nKnowledgeIDIndex < vKnowledgeSlots.size() ; ++nKnowledgeIDIndex)
+			// The permutations are only needed for this combination, so the thread's arena is reused for each one
+			CArena& arena = *solveThread.pArena;
+			arena.Reset();
+			auto& vPermutations = solveThread.vPermutations;
+			vPermutations.clear();
+			if (!GeneratePermutationsInArena(arena, vPermutations, vKnowledge.data(), static_cast<int>(vKnowledge.size())))
 			{
-				const TKnowledgeID nKnowledgeID = vPermutation[nKnowledgeIDIndex];
-				auto itKnowledge = g_Env.mapKnowledges.find(nKnowledgeID);
-				if (itKnowledge == g_Env.mapKnowledges.end())
-				{
-					printf("Failed to find knowledge: %d\n", nKnowledgeID);
-					return false;
-				}
-				SKnowledge& knowledge = itKnowledge->second;
-				vKnowledgeSlots[nKnowledgeIDIndex] = knowledge;
+				bFailed = true;
+				break;
 			}
-			
-			result.Clear();
-			Simulate(result, targetSolve.nInterestLevel, targetSolve.nFavor, constellation, vKnowledgeSlots);
 
-			for (const SThing& thing : vThings)
+			// Permutations are simulated a batch at a time, then offered to the goal params in order
+			const int nNumSlots = constellation.nNumSlots;
+			const int nNumPermutations = static_cast<int>(vPermutations.size());
+			std::array<int, SIMULATION_BATCH_LANES * MAX_CONSTELLATION_SLOTS> aPermutationSlots;
+			for (int nFirstPermutation = 0 ; nFirstPermutation < nNumPermutations && !bFailed ; nFirstPermutation += SIMULATION_BATCH_LANES)
 			{
-				auto& resultBest = result.bestCombinationStats.aBestCombinations[thing.eGoal][thing.nGoalParam];
-				auto& targetBest = targetSolve.bestCombinations.aBestCombinations[thing.eGoal][thing.nGoalParam];
-				resultBest.fStrictEV *= resultBest.fSuccessPercentage;
-				bool bReplaceBest = (targetBest.vKnowledge.empty());
-				if (!bReplaceBest)
+				const int nNumBatchPermutations = std::min(SIMULATION_BATCH_LANES, nNumPermutations - nFirstPermutation);
+				for (int nBatchPermutation = 0 ; nBatchPermutation < nNumBatchPermutations && !bFailed ; ++nBatchPermutation)
 				{
-					const double fSuccessDeltaEV = (targetBest.fSuccessPercentage - resultBest.fSuccessPercentage) * g_Env.fDeltaSuccessEVMultiplier;
-					if (resultBest.fStrictEV > (targetBest.fStrictEV + fSuccessDeltaEV))
+					const TKnowledgeID* pPermutation = vPermutations[nFirstPermutation + nBatchPermutation];
+					for (int nKnowledgeIDIndex = 0 ; nKnowledgeIDIndex < nNumSlots ; ++nKnowledgeIDIndex)
 					{
-						bReplaceBest = true;
+						const TKnowledgeID nKnowledgeID = pPermutation[nKnowledgeIDIndex];
+						int& nKnowledge = aPermutationSlots[nBatchPermutation * nNumSlots + nKnowledgeIDIndex];
+						nKnowledge = knowledgeTable.GetIndex(nKnowledgeID);
+						if (nKnowledge < 0)
+						{
+							printf("Failed to find knowledge: %d\n", nKnowledgeID);
+							bFailed = true;
+							break;
+						}
 					}
+					solveThread.aResults[nBatchPermutation].Clear();
+				}
+				if (bFailed)
+				{
+					break;
 				}
 
-				if (bReplaceBest)
+				SimulateBatch(solveThread.aResults.data(), targetSolve.nInterestLevel, targetSolve.nFavor, constellation, knowledgeTable, aPermutationSlots.data(), nNumBatchPermutations);
+				solveThread.zPermutations += nNumBatchPermutations;
+
+				for (int nBatchPermutation = 0 ; nBatchPermutation < nNumBatchPermutations ; ++nBatchPermutation)
 				{
-					targetBest.fStrictEV = resultBest.fStrictEV;
-					targetBest.fSuccessPercentage = resultBest.fSuccessPercentage;
-					targetBest.vKnowledge.resize(vKnowledgeSlots.size());
-					for (int nKnowledgeIDIndex = 0 ; nKnowledgeIDIndex < vKnowledgeSlots.size() ; ++nKnowledgeIDIndex)
+					const TKnowledgeID* pPermutation = vPermutations[nFirstPermutation + nBatchPermutation];
+					SCombinationResult& result = solveThread.aResults[nBatchPermutation];
+					for (const SThing& thing : vThings)
 					{
-						const int nKnowledgeID = vKnowledgeSlots[nKnowledgeIDIndex].nID;
-						targetBest.vKnowledge[nKnowledgeIDIndex] = nKnowledgeID;
+						auto& resultBest = result.bestCombinationStats.aBestCombinations[thing.eGoal][thing.nGoalParam];
+						auto& targetBest = targetSolve.bestCombinations.aBestCombinations[thing.eGoal][thing.nGoalParam];
+						resultBest.fStrictEV *= resultBest.fSuccessPercentage;
+						bool bReplaceBest = (targetBest.vKnowledge.empty());
+						if (!bReplaceBest)
+						{
+							const double fSuccessDeltaEV = (targetBest.fSuccessPercentage - resultBest.fSuccessPercentage) * g_Env.fDeltaSuccessEVMultiplier;
+							if (resultBest.fStrictEV > (targetBest.fStrictEV + fSuccessDeltaEV))
+							{
+								bReplaceBest = true;
+							}
+						}
+
+						if (bReplaceBest)
+						{
+							targetBest.fStrictEV = resultBest.fStrictEV;
+							targetBest.fSuccessPercentage = resultBest.fSuccessPercentage;
+							targetBest.vKnowledge.assign(pPermutation, pPermutation + nNumSlots);
+						}
 					}
 				}
 			}
+			++nUniqueCombinationsDone;
 		}
+	});
+
+	if (bFailed)
+	{
+		return false;
+	}
+
+	size_t zPermutations = 0;
+	for (const SSolveThread& solveThread : vSolveThreads)
+	{
+		zPermutations += solveThread.zPermutations;
+		targetSolve.bProvisional |= solveThread.bOutOfTime;
 	}
 	printf("Total number of permutations generated: %zd\n", zPermutations);
+	PrintSolveArenaStats();
+	if (targetSolve.bProvisional)
+	{
+		printf("Solve time budget of %.3fs ran out while reordering permutations, results are provisional\n", g_Env.fSolveTimeBudget);
+	}
+
+	return true;
+}
+
+// Goal params simulated annealing optimizes for directly. Every permutation it scores is offered to all goal params, so the ones
+// in between are covered by the neighbouring searches.
+static void GetAnnealObjectives(std::vector<std::pair<EGoal, int>>& vObjectives)
+{
+	const SBestCombinations bestCombinations;
+	for (int nGoal = 0 ; nGoal < NUM_GOALS ; ++nGoal)
+	{
+		const int nNumGoalParams = static_cast<int>(bestCombinations.aBestCombinations[nGoal].size());
+		for (int nGoalParam = 0 ; nGoalParam < nNumGoalParams ; ++nGoalParam)
+		{
+			if ((nGoalParam % g_Env.nAnnealGoalParamStride) == 0 || nGoalParam == nNumGoalParams - 1)
+			{
+				vObjectives.emplace_back(static_cast<EGoal>(nGoal), nGoalParam);
+			}
+		}
+	}
+}
+
+// Anneals over which knowledge fills the slots and in what order, maximizing the score the replace rule compares for one goal param
+static void AnnealObjective(EGoal eGoal, int nGoalParam, uint32_t nSeed, STargetSolve& targetSolve, SCombinationResult& result, size_t& zPermutations,
+	const SConstellation& constellation, const SKnowledgeTable& knowledgeTable)
+{
+	std::mt19937 rng(nSeed);
+	const int nNumKnowledge = knowledgeTable.GetNumKnowledge();
+	const int nNumSlots = constellation.nNumSlots;
+
+	// The first nNumSlots entries are the permutation, the rest are the unused knowledge
+	std::vector<int> vKnowledge(nNumKnowledge);
+	for (int nKnowledge = 0 ; nKnowledge < nNumKnowledge ; ++nKnowledge)
+	{
+		vKnowledge[nKnowledge] = nKnowledge;
+	}
+	std::shuffle(vKnowledge.begin(), vKnowledge.end(), rng);
+
+	std::array<TKnowledgeID, MAX_CONSTELLATION_SLOTS> aKnowledgeIDs;
+	auto fnScore = [&]() -> double
+	{
+		++zPermutations;
+		for (int nSlot = 0 ; nSlot < nNumSlots ; ++nSlot)
+		{
+			aKnowledgeIDs[nSlot] = knowledgeTable.vIDs[vKnowledge[nSlot]];
+		}
+
+		result.Clear();
+		Simulate(result, targetSolve.nInterestLevel, targetSolve.nFavor, constellation, knowledgeTable, vKnowledge.data(), nNumSlots);
+		UpdateBestCombinations(targetSolve.bestCombinations, result, aKnowledgeIDs.data(), nNumSlots);
+
+		const auto& resultBest = result.bestCombinationStats.aBestCombinations[eGoal][nGoalParam];
+		return resultBest.fStrictEV + resultBest.fSuccessPercentage * g_Env.fDeltaSuccessEVMultiplier;
+	};
+
+	// Without slots the empty permutation is the only one, there are no moves to make
+	double fScore = fnScore();
+	if (nNumSlots == 0)
+	{
+		return;
+	}
+
+	std::uniform_real_distribution<double> chanceDistribution(0.0, 1.0);
+	std::uniform_int_distribution<int> slotDistribution(0, nNumSlots - 1);
+	std::uniform_int_distribution<int> unusedDistribution(nNumSlots, std::max(nNumSlots, nNumKnowledge - 1));
+
+	for (int nIteration = 0 ; nIteration < g_Env.nAnnealIterations ; ++nIteration)
+	{
+		const double fProgress = static_cast<double>(nIteration) / g_Env.nAnnealIterations;
+		const double fTemperature = g_Env.fAnnealStartTemperature * std::pow(g_Env.fAnnealEndTemperature / g_Env.fAnnealStartTemperature, fProgress);
+
+		// Either swap in unused knowledge or swap two slots, then undo the move if it's rejected
+		const int nSlot = slotDistribution(rng);
+		int nOther = slotDistribution(rng);
+		if (nNumKnowledge > nNumSlots && (nSlot == nOther || chanceDistribution(rng) < 0.5))
+		{
+			nOther = unusedDistribution(rng);
+		}
+		if (nSlot == nOther)
+		{
+			continue;
+		}
+		std::swap(vKnowledge[nSlot], vKnowledge[nOther]);
+
+		const double fNewScore = fnScore();
+		if (fNewScore >= fScore || chanceDistribution(rng) < std::exp((fNewScore - fScore) / fTemperature))
+		{
+			fScore = fNewScore;
+		}
+		else
+		{
+			std::swap(vKnowledge[nSlot], vKnowledge[nOther]);
+		}
+	}
+}
+
+bool SimulateCombinationsAnneal(const STarget& target, STargetSolve& targetSolve)
+{
+	auto itConstellation = g_Env.mapConstellations.find(target.nConstellationID);
+	if (itConstellation == g_Env.mapConstellations.end())
+	{
+		printf("Failed to find constellation: %d\n", target.nConstellationID);
+		return false;
+	}
+	const SConstellation& constellation = itConstellation->second;
+
+	if (constellation.nNumSlots > MAX_CONSTELLATION_SLOTS)
+	{
+		printf("Constellation %d has too many slots: %d (max %d)\n", constellation.nID, constellation.nNumSlots, MAX_CONSTELLATION_SLOTS);
+		return false;
+	}
+
+	if (static_cast<int>(constellation.vSlotOrder.size()) != constellation.nNumSlots)
+	{
+		printf("Constellation %d slot order doesn't match its slot count: %d vs. %d\n", constellation.nID, static_cast<int>(constellation.vSlotOrder.size()), constellation.nNumSlots);
+		return false;
+	}
+
+	auto itCategory = g_Env.mapKnowledgeCategories.find(target.nKnowledgeCategoryID);
+	if (itCategory == g_Env.mapKnowledgeCategories.end())
+	{
+		printf("Failed to find knowledge category: %d\n", target.nKnowledgeCategoryID);
+		return false;
+	}
+	const auto& category = itCategory->second;
+
+	SKnowledgeTable knowledgeTable;
+	if (!knowledgeTable.Build(category))
+	{
+		return false;
+	}
+
+	if (knowledgeTable.GetNumKnowledge() < constellation.nNumSlots)
+	{
+		printf("Refusing to simulate, category has %d knowledge for %d slots\n", knowledgeTable.GetNumKnowledge(), constellation.nNumSlots);
+		return false;
+	}
+
+	std::vector<std::pair<EGoal, int>> vObjectives;
+	GetAnnealObjectives(vObjectives);
+
+	// Every objective gets its own seed, so the results only depend on the seed and not on the thread count
+	const uint32_t nSeed = (g_Env.nAnnealSeed != 0) ? g_Env.nAnnealSeed : static_cast<uint32_t>(g_Env.randomDevice());
+	printf("Annealing knowledge permutations for:\n- Target: %s\n- Knowledge category: %d\n- Constellation: %d\n- Objectives: %d\n- Iterations: %d\n- Seed: %u\n",
+		target.sName.c_str(), target.nKnowledgeCategoryID, target.nConstellationID, static_cast<int>(vObjectives.size()), g_Env.nAnnealIterations, nSeed);
+
+	struct SSolveThread
+	{
+		STargetSolve targetSolve;
+		SCombinationResult result;
+		size_t zPermutations = 0;
+	};
+	const int nNumThreads = GetNumSolveThreads();
+	std::vector<SSolveThread> vSolveThreads(nNumThreads);
+	for (SSolveThread& solveThread : vSolveThreads)
+	{
+		solveThread.targetSolve = targetSolve;
+	}
+	printf("Solving on %d threads\n", nNumThreads);
+
+	std::seed_seq seedSequence{nSeed};
+	std::vector<uint32_t> vObjectiveSeeds(vObjectives.size());
+	seedSequence.generate(vObjectiveSeeds.begin(), vObjectiveSeeds.end());
+
+	ParallelForChunks(0, static_cast<int64_t>(vObjectives.size()), 1, nNumThreads, [&](int nThread, int64_t nChunkBegin, int64_t nChunkEnd)
+	{
+		SSolveThread& solveThread = vSolveThreads[nThread];
+		for (int64_t nObjective = nChunkBegin ; nObjective < nChunkEnd ; ++nObjective)
+		{
+			AnnealObjective(vObjectives[nObjective].first, vObjectives[nObjective].second, vObjectiveSeeds[nObjective], solveThread.targetSolve, solveThread.result, solveThread.zPermutations,
+				constellation, knowledgeTable);
+		}
+	});
+
+	size_t zPermutations = 0;
+	for (const SSolveThread& solveThread : vSolveThreads)
+	{
+		MergeBestCombinations(targetSolve.bestCombinations, solveThread.targetSolve.bestCombinations);
+		zPermutations += solveThread.zPermutations;
+	}
+	printf("Total number of permutations simulated: %zd\n", zPermutations);
 
 	return true;
 }
@@ -6,4 +6,16 @@
 bool SimulateCombinations(const STarget& target, STargetSolve& targetSolve);
 bool SimulateCombinationsFast(const STarget& target, STargetSolve& targetSolve);
 
+// Simulated annealing over knowledge choice and order, for categories too large to enumerate. Results are approximate.
+bool SimulateCombinationsAnneal(const STarget& target, STargetSolve& targetSolve);
+
+// Full solve of several interest/favor cells of the same target, each permutation is enumerated once for all of them
+bool SimulateCombinationsGrid(const STarget& target, std::vector<STargetSolve>& vTargetSolves);
+
+// Scores each permutation for the target solve and keeps the ones that beat its best combinations, a full solve started from these
+// seeds prunes from the start and ends up with the same results
+bool SeedBestCombinations(const STarget& target, STargetSolve& targetSolve, const std::vector<std::vector<TKnowledgeID>>& vSeedPermutations);
+// Seeds every cell of a grid solve with the same permutations
+bool SeedBestCombinationsGrid(const STarget& target, std::vector<STargetSolve>& vTargetSolves, const std::vector<std::vector<TKnowledgeID>>& vSeedPermutations);
+
 #endif // !defined(SIMULATION_H)
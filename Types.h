@@ -5,6 +5,9 @@
 #include <vector>
 #include <random>
 #include <map>
+#include <algorithm>
+#include <type_traits>
+#include <cstdint>
 
 enum EGoal
 {
@@ -20,8 +23,17 @@ enum EGoal
 };
 extern const std::array<std::string, NUM_GOALS> aGoalNames;
 
+enum EGoalAccumulation
+{
+	GOAL_ACCUMULATION_THRESHOLDS, // Tests every goal param at every finished path
+	GOAL_ACCUMULATION_HISTOGRAM, // Bins every finished path by goal statistic, goal params are filled in once per permutation. Sums in a different order, so results can differ in the last bits
+};
+
 typedef unsigned short TKnowledgeID;
 
+// Largest constellation the solver handles, bounds the inline per-slot storage used by the simulation
+const int MAX_CONSTELLATION_SLOTS = 16;
+
 struct STarget
 {
 	int nID = -1;
@@ -76,10 +88,18 @@ struct SConstellation
 	std::vector<int> vSlotOrder;
 };
 
+// Per-slot target state for one permutation, in play order
+struct SSimulationTimeline
+{
+	int nNumSlots = 0;
+	std::array<double, MAX_CONSTELLATION_SLOTS> aTargetInterestLevel;
+	std::array<int, MAX_CONSTELLATION_SLOTS> aTargetFavor;
+	std::array<double, MAX_CONSTELLATION_SLOTS> aSparkChance;
+	std::array<int, MAX_CONSTELLATION_SLOTS> aFavorGain;
+};
+
 struct SSimulationStatus
 {
-	double fTargetInterestLevel = 0;
-	int nTargetFavor = 0;
 	double fChance = 1.0f;
 
 	int nSpark = 0;
@@ -91,9 +111,8 @@ struct SSimulationStatus
 	int nMaxConsecutiveSpark = 0;
 	int nCurrentConsecutiveSparkFailure = 0;
 	int nMaxConsecutiveSparkFailure = 0;
-
-	std::vector<SComboEffect> vComboEffects;
 };
+static_assert(std::is_trivially_copyable<SSimulationStatus>::value, "Simulation status is copied on every branch, it must stay a plain block of memory");
 
 struct SSimulationStatusFinal
 {
@@ -158,12 +177,48 @@ struct SBestCombinations
 
 struct SCombinationResult
 {
+	SCombinationResult()
+	{
+		for (int nGoal = 0 ; nGoal < NUM_GOALS ; ++nGoal)
+		{
+			const size_t zNumGoalParams = bestCombinationStats.aBestCombinations[nGoal].size();
+			aGoalHistograms[nGoal].vChance.resize(zNumGoalParams);
+			aGoalHistograms[nGoal].vModifiedAccumulatedFavor.resize(zNumGoalParams);
+		}
+	}
+
 	void Clear()
 	{
-		bestCombinationStats.Clear();
+		for (int nGoal = 0 ; nGoal < NUM_GOALS ; ++nGoal)
+		{
+			ClearGoal(static_cast<EGoal>(nGoal));
+		}
+	}
+
+	// Only clears what a single goal's simulation writes
+	void ClearGoal(EGoal eGoal)
+	{
+		for (SBestCombinations::SBestCombination& combination : bestCombinationStats.aBestCombinations[eGoal])
+		{
+			combination.vKnowledge.clear();
+			combination.fStrictEV = 0.0f;
+			combination.fSuccessPercentage = 0.0f;
+		}
+
+		SGoalHistogram& histogram = aGoalHistograms[eGoal];
+		std::fill(histogram.vChance.begin(), histogram.vChance.end(), 0.0);
+		std::fill(histogram.vModifiedAccumulatedFavor.begin(), histogram.vModifiedAccumulatedFavor.end(), 0.0);
 	}
 
 	SBestCombinations bestCombinationStats;
+
+	// Finished paths binned by goal statistic, anything past the last goal param goes in the last bin
+	struct SGoalHistogram
+	{
+		std::vector<double> vChance;
+		std::vector<double> vModifiedAccumulatedFavor;
+	};
+	std::array<SGoalHistogram, NUM_GOALS> aGoalHistograms;
 };
 
 struct STargetSolve
@@ -172,6 +227,8 @@ struct STargetSolve
 	int nInterestLevel = 0;
 	int nFavor = 0;
 	bool bFastSolve = false;
+	bool bAnnealSolve = false;
+	bool bProvisional = false; // The solve's time budget ran out, results are the best of the combinations simulated so far
 	SBestCombinations bestCombinations;
 };
 
@@ -193,9 +250,36 @@ struct SEnvironment
 
 	const int nResultsVersion = 3;
 	const bool bSafetyChecks = false;
+	const EGoalAccumulation eGoalAccumulation = GOAL_ACCUMULATION_HISTOGRAM;
+	const bool bPrunePermutations = true; // Skips permutation prefixes that can't beat the current best for any goal param, results are unchanged
+	const bool bMergeEquivalentKnowledge = true; // Skips combinations and permutations that only swap knowledge the simulation can't tell apart, results are unchanged
 	const double fSolvePrintTime = 0.5f;
 	const double fStorePrintTime = 0.5f;
 	const float fDeltaSuccessEVMultiplier = 15.0f * 100.0f; // Guesswork
+	const int nSolveChunkSize = 16; // Combinations handed to a solve thread at a time
+	const int nGridSolveCells = 64; // Interest/favor cells SolveGrid solves together, each thread keeps best combinations for all of them
+	const bool bWarmStartSolves = true; // Seeds full solves with the stored results of neighbouring interest/favor cells, results are unchanged
+	const int nWarmStartRadius = 1; // Interest and favor distance of the cells used to seed a solve
+	const int nAnnealIterations = 2000; // Moves tried per annealed goal param
+	const int nAnnealGoalParamStride = 10; // Every Nth goal param of each goal is annealed for, plus the last
+	const double fAnnealStartTemperature = 50.0f; // In units of the replace rule's score, strict EV plus success times fDeltaSuccessEVMultiplier
+	const double fAnnealEndTemperature = 0.1f;
+	const uint32_t nAnnealSeed = 0; // 0 picks a random seed, the seed used is printed so a solve can be repeated
+	const double fCheckpointTime = 300.0; // Seconds between checkpoints of full solves to the working directory, 0 to never checkpoint
+	const int64_t nCheckpointCombinations = 65536; // Combinations between chances to checkpoint, the solve threads wait for each other at these
+	const size_t zArenaChunkSize = 2 * 1024 * 1024; // Bytes the solve arenas get from the system at a time, a multiple of the huge page size
+	const bool bArenaHugePages = false; // Asks for huge pages for the solve arenas, needs the lock pages in memory privilege on Windows
+	const char* const szResultsCachePath = "results_cache.bin"; // Memory mapped results cache shared by every process, nullptr to not cache results
+	const int nResultsCacheFileSlots = 1024; // Target states the cache file holds, about 24KB each
+	const int nResultsCacheFileProbes = 4; // Slots a target state may be cached in
+	const bool bStoreResultsBlobs = false; // Stores each target state's results as one packed row of results_blobs instead of a row per goal param
+	const bool bLoadEnvironmentSnapshot = false; // Loads knowledge, targets and constellations from the snapshot file instead of the database, run WriteSnapshot after changing them
+	const char* const szEnvironmentSnapshotPath = "environment_snapshot.bin";
+	const bool bPipelineQueries = true; // Sends queued statements in one round trip with libpq's pipeline mode, otherwise one at a time. Needs libpq 14 or newer.
+
+	int nNumSolveThreads = 0; // 0 uses every hardware thread
+	double fSolveTimeBudget = 0.0; // Seconds a solve may take before it returns provisional results, 0 for no budget
+	bool bResumeSolves = false; // Full solves continue from their checkpoint if there is one
 };
 extern SEnvironment g_Env;
 
@@ -1,6 +1,20 @@
 #include "Utils.h"
 
 #include <algorithm>
+#include <thread>
+#include <memory>
+#include <cstdio>
+
+#if defined(_WIN32)
+#define _WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#undef min
+#undef max
+#else
+#include <sys/mman.h>
+#endif // defined(_WIN32)
+
+#include "Types.h"
 
 std::string GetLowerString(const std::string& sString)
 {
@@ -13,3 +27,221 @@ void LowerString(std::string& sString)
 {
 	std::transform(sString.begin(), sString.end(), sString.begin(), ::tolower);
 }
+
+
+// Chunks come straight from the system rather than the heap, so they can be backed by huge pages. Huge pages are only a request,
+// without them (or the privilege to use them) the chunk gets normal pages.
+static unsigned char* AllocArenaChunk(size_t zSize)
+{
+#if defined(_WIN32)
+	if (g_Env.bArenaHugePages)
+	{
+		const size_t zLargePageSize = GetLargePageMinimum();
+		if (zLargePageSize > 0 && zSize % zLargePageSize == 0)
+		{
+			void* pData = VirtualAlloc(nullptr, zSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+			if (pData != nullptr)
+			{
+				return static_cast<unsigned char*>(pData);
+			}
+		}
+	}
+	return static_cast<unsigned char*>(VirtualAlloc(nullptr, zSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+#else
+	void* pData = mmap(nullptr, zSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pData == MAP_FAILED)
+	{
+		return nullptr;
+	}
+#if defined(MADV_HUGEPAGE)
+	if (g_Env.bArenaHugePages)
+	{
+		madvise(pData, zSize, MADV_HUGEPAGE);
+	}
+#endif // defined(MADV_HUGEPAGE)
+	return static_cast<unsigned char*>(pData);
+#endif // defined(_WIN32)
+}
+
+static void FreeArenaChunk(unsigned char* pData, size_t zSize)
+{
+#if defined(_WIN32)
+	VirtualFree(pData, 0, MEM_RELEASE);
+#else
+	munmap(pData, zSize);
+#endif // defined(_WIN32)
+}
+
+CArena::~CArena()
+{
+	for (const SChunk& chunk : m_vChunks)
+	{
+		FreeArenaChunk(chunk.pData, chunk.zSize);
+	}
+}
+
+void* CArena::AllocBytes(size_t zSize, size_t zAlignment)
+{
+	while (true)
+	{
+		if (m_zChunk < m_vChunks.size())
+		{
+			const SChunk& chunk = m_vChunks[m_zChunk];
+			const size_t zOffset = (m_zChunkOffset + zAlignment - 1) / zAlignment * zAlignment;
+			if (zOffset <= chunk.zSize && zSize <= chunk.zSize - zOffset)
+			{
+				m_zChunkOffset = zOffset + zSize;
+				m_zPeakBytes = std::max(m_zPeakBytes, GetUsedBytes());
+				return chunk.pData + zOffset;
+			}
+
+			// Kept chunks too small for this are skipped over like the end of a full one
+			m_zUsedBeforeChunk += chunk.zSize;
+			m_zChunkOffset = 0;
+			++m_zChunk;
+			continue;
+		}
+
+		// Chunks are whole multiples of the chunk size, big allocations get a chunk of their own
+		const size_t zChunkSize = std::max<size_t>(g_Env.zArenaChunkSize, 1);
+		const size_t zNewChunkSize = (zSize + zAlignment + zChunkSize - 1) / zChunkSize * zChunkSize;
+		SChunk chunk;
+		chunk.pData = AllocArenaChunk(zNewChunkSize);
+		if (chunk.pData == nullptr)
+		{
+			printf("Failed to allocate %zu bytes of arena memory\n", zNewChunkSize);
+			return nullptr;
+		}
+		chunk.zSize = zNewChunkSize;
+		m_vChunks.push_back(chunk);
+		m_zReservedBytes += zNewChunkSize;
+	}
+}
+
+void CArena::Reset()
+{
+	m_zChunk = 0;
+	m_zChunkOffset = 0;
+	m_zUsedBeforeChunk = 0;
+}
+
+static std::mutex s_solveArenasMutex;
+static std::vector<std::unique_ptr<CArena>> s_vSolveArenas;
+
+CArena& GetSolveArena(int nThread)
+{
+	std::lock_guard<std::mutex> lock(s_solveArenasMutex);
+	while (static_cast<int>(s_vSolveArenas.size()) <= nThread)
+	{
+		s_vSolveArenas.emplace_back(new CArena());
+	}
+	return *s_vSolveArenas[nThread];
+}
+
+void ResetSolveArenas()
+{
+	std::lock_guard<std::mutex> lock(s_solveArenasMutex);
+	for (const auto& pArena : s_vSolveArenas)
+	{
+		pArena->Reset();
+		pArena->ResetPeak();
+	}
+}
+
+void PrintSolveArenaStats()
+{
+	std::lock_guard<std::mutex> lock(s_solveArenasMutex);
+	size_t zPeakBytes = 0;
+	size_t zReservedBytes = 0;
+	for (const auto& pArena : s_vSolveArenas)
+	{
+		zPeakBytes += pArena->GetPeakBytes();
+		zReservedBytes += pArena->GetReservedBytes();
+	}
+	printf("Solve arenas: %.2f MB peak use, %.2f MB reserved over %d threads\n", zPeakBytes / (1024.0 * 1024.0), zReservedBytes / (1024.0 * 1024.0),
+		static_cast<int>(s_vSolveArenas.size()));
+}
+
+int GetNumSolveThreads()
+{
+	if (g_Env.nNumSolveThreads > 0)
+	{
+		return g_Env.nNumSolveThreads;
+	}
+	return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+uint64_t GetNumCombinations(int nObjects, int nResultSlots)
+{
+	if (nResultSlots < 0 || nResultSlots > nObjects)
+	{
+		return 0;
+	}
+
+	// Multiplying then dividing one step at a time keeps every intermediate value a whole binomial coefficient
+	nResultSlots = std::min(nResultSlots, nObjects - nResultSlots);
+	uint64_t nNumCombinations = 1;
+	for (int nSlot = 1 ; nSlot <= nResultSlots ; ++nSlot)
+	{
+		const uint64_t nFactor = static_cast<uint64_t>(nObjects - nResultSlots + nSlot);
+		if (nNumCombinations > UINT64_MAX / nFactor)
+		{
+			return UINT64_MAX;
+		}
+		nNumCombinations = nNumCombinations * nFactor / nSlot;
+	}
+	return nNumCombinations;
+}
+
+uint64_t GetNumPermutations(int nObjects, int nResultSlots)
+{
+	uint64_t nNumPermutations = GetNumCombinations(nObjects, nResultSlots);
+	for (int nSlot = 2 ; nSlot <= nResultSlots ; ++nSlot)
+	{
+		if (nNumPermutations > UINT64_MAX / nSlot)
+		{
+			return UINT64_MAX;
+		}
+		nNumPermutations *= nSlot;
+	}
+	return nNumPermutations;
+}
+
+void UnrankCombination(int* pIndices, int nObjects, int nResultSlots, uint64_t nRank)
+{
+	int nIndex = 0;
+	for (int nSlot = 0 ; nSlot < nResultSlots ; ++nSlot)
+	{
+		while (true)
+		{
+			const uint64_t nNumStartingHere = GetNumCombinations(nObjects - nIndex - 1, nResultSlots - nSlot - 1);
+			if (nRank < nNumStartingHere)
+			{
+				break;
+			}
+			nRank -= nNumStartingHere;
+			++nIndex;
+		}
+		pIndices[nSlot] = nIndex++;
+	}
+}
+
+void UnrankPermutation(int* pOrder, int nResultSlots, uint64_t nRank)
+{
+	std::vector<int> vUnused(nResultSlots);
+	for (int nSlot = 0 ; nSlot < nResultSlots ; ++nSlot)
+	{
+		vUnused[nSlot] = nSlot;
+	}
+
+	uint64_t nPlaceValue = GetNumPermutations(nResultSlots, nResultSlots);
+	for (int nSlot = 0 ; nSlot < nResultSlots ; ++nSlot)
+	{
+		nPlaceValue /= (nResultSlots - nSlot);
+		const int nDigit = static_cast<int>(nRank / nPlaceValue);
+		nRank %= nPlaceValue;
+
+		pOrder[nSlot] = vUnused[nDigit];
+		vUnused.erase(vUnused.begin() + nDigit);
+	}
+}
\ No newline at end of file
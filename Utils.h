@@ -3,50 +3,110 @@
 
 #include <string>
 #include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <algorithm>
 
 std::string GetLowerString(const std::string& sString);
 void LowerString(std::string& sString);
 
-// Block allocator using static memory
-template <typename T>
-class CMemory
+// Bump allocator over chunks of memory. Resetting it hands the same chunks out again instead of freeing them, so a process solving
+// one target after another only asks the system for memory when a solve needs more than any before it.
+// Not thread safe, every solve thread index has its own from GetSolveArena.
+class CArena
 {
 public:
-	static std::vector<T> s_vBlocks;
-	static int s_nBlockIndex;
-	static void Init(int nNumBlocks)
-	{
-		s_vBlocks.resize(nNumBlocks);
-		s_nBlockIndex = 0;
-	}
+	CArena() {}
+	~CArena();
+	CArena(const CArena&) = delete;
+	CArena& operator=(const CArena&) = delete;
+
+	// Room for zNum Ts, which aren't constructed, so only trivial types belong here. nullptr if the system is out of memory.
+	template <typename T>
+	T* Alloc(size_t zNum) { return static_cast<T*>(AllocBytes(zNum * sizeof(T), alignof(T))); }
+	void* AllocBytes(size_t zSize, size_t zAlignment);
+
+	// Everything allocated so far is given up, the chunks are kept for the next allocations
+	void Reset();
+	// Peak use is counted again from what's in use now
+	void ResetPeak() { m_zPeakBytes = GetUsedBytes(); }
 
+	size_t GetUsedBytes() const { return m_zUsedBeforeChunk + m_zChunkOffset; }
+	size_t GetPeakBytes() const { return m_zPeakBytes; }
+	size_t GetReservedBytes() const { return m_zReservedBytes; }
 
-	static T* Alloc(int nNum)
+private:
+	struct SChunk
 	{
-		T* pReturn = &s_vBlocks[s_nBlockIndex];
-		s_nBlockIndex += nNum;
-		if (s_nBlockIndex > s_vBlocks.size())
-		{
-			return nullptr;
-		}
-		return pReturn;
-	}
+		unsigned char* pData = nullptr;
+		size_t zSize = 0;
+	};
+
+	std::vector<SChunk> m_vChunks;
+	size_t m_zChunk = 0; // Chunk allocations come from, past the end when there's none yet
+	size_t m_zChunkOffset = 0;
+	size_t m_zUsedBeforeChunk = 0; // Bytes of the chunks before the current one, including the ends they were left with
+	size_t m_zPeakBytes = 0;
+	size_t m_zReservedBytes = 0;
 };
 
-template <typename T>
-std::vector<T> CMemory<T>::s_vBlocks;
-template <typename T>
-int CMemory<T>::s_nBlockIndex = 0;
+// Arena of solve thread index nThread, kept for the life of the process. The arenas are looked up under a lock,
+// so a solve fetches each thread's arena once up front rather than per combination.
+CArena& GetSolveArena(int nThread);
+// Reset every solve arena and its peak use, for the start of a solve
+void ResetSolveArenas();
+// Peak use since the last ResetSolveArenas
+void PrintSolveArenaStats();
 
 template <typename T>
 inline void GeneratePermutations(std::vector<std::vector<T>>& vResults, const std::vector<T>& vStartingCombination);
 template <typename T>
 inline std::vector<std::vector<T>> GenerateCombinationsAndPermutations(const std::vector<T>& vObjects, int nResultSlots);
 
+// Same results as GeneratePermutations, each one nResultSlots Ts allocated from the arena. Returns false if the arena runs out of memory.
 template <typename T>
-inline void GeneratePermutationsStaticMemory(std::vector<T*>& vResults, T* pStartingCombination, int nResultSlots);
+inline bool GeneratePermutationsInArena(CArena& arena, std::vector<T*>& vResults, const T* pStartingCombination, int nResultSlots);
+
+// Lazy version of GenerateCombinationsAndPermutations, yields the same results in the same order one at a time.
+// Generation can start at any rank, so separate ranges of results can be generated independently.
 template <typename T, bool t_bPermutations>
-inline std::vector<T*> GenerateCombinationsAndPermutationsStaticMemory(const std::vector<T>& vObjects, int nResultSlots);
+class CCombinationGenerator
+{
+public:
+	CCombinationGenerator(const std::vector<T>& vObjects, int nResultSlots, uint64_t nFirstRank = 0);
+
+	// Copies the next result into pResult, returns false once every result has been generated
+	inline bool Next(T* pResult);
+
+private:
+	std::vector<T> m_vSortedObjects;
+	std::vector<int> m_vIndices;
+	std::vector<T> m_vPermutation;
+	int m_nResultSlots = 0;
+	bool m_bStarted = false;
+	bool m_bPending = false;
+	bool m_bDone = false;
+};
+
+// Number of ways to choose nResultSlots of nObjects, saturates instead of overflowing
+uint64_t GetNumCombinations(int nObjects, int nResultSlots);
+// Number of ways to choose nResultSlots of nObjects in order, saturates instead of overflowing
+uint64_t GetNumPermutations(int nObjects, int nResultSlots);
+
+// Combination of nObjects with the given rank as its sorted indices, combinations are ranked in lexicographic order
+void UnrankCombination(int* pIndices, int nObjects, int nResultSlots, uint64_t nRank);
+// Ordering of nResultSlots items with the given rank, orderings are ranked in lexicographic order
+void UnrankPermutation(int* pOrder, int nResultSlots, uint64_t nRank);
+
+// Runs fnWork(nThread) once on each of nNumThreads threads and waits for them all
+template <typename TWork>
+inline void RunOnThreads(int nNumThreads, const TWork& fnWork);
+// Runs fnWork(nThread, nChunkBegin, nChunkEnd) over [nBegin, nEnd) split into chunks, on nNumThreads threads with work stealing
+template <typename TWork>
+inline void ParallelForChunks(int64_t nBegin, int64_t nEnd, int64_t nChunkSize, int nNumThreads, const TWork& fnWork);
+int GetNumSolveThreads();
 
 #include "Utils.inl"
 
@@ -43,68 +43,237 @@ inline std::vector<std::vector<T>> GenerateCombinationsAndPermutations(const std
 }
 
 template <typename T>
-inline void GeneratePermutationsStaticMemory(std::vector<T*>& vResults, T* pStartingCombination, int nResultSlots)
+inline bool GeneratePermutationsInArena(CArena& arena, std::vector<T*>& vResults, const T* pStartingCombination, int nResultSlots)
 {
-	std::vector<T> vCurrentResult(nResultSlots);
-	for (int nSlot = 0 ; nSlot < nResultSlots ; ++nSlot)
-	{
-		vCurrentResult[nSlot] = pStartingCombination[nSlot];
-	}
-
+	std::vector<T> vCurrentResult(pStartingCombination, pStartingCombination + nResultSlots);
 	do
 	{
-		T* pNewResult = CMemory<T>::Alloc(nResultSlots);
-		memcpy(pNewResult, vCurrentResult.data(), nResultSlots * sizeof(T));
+		T* pNewResult = arena.Alloc<T>(nResultSlots);
+		if (pNewResult == nullptr)
+		{
+			return false;
+		}
+		std::copy(vCurrentResult.begin(), vCurrentResult.end(), pNewResult);
 		vResults.push_back(pNewResult);
 	} while (std::next_permutation(vCurrentResult.begin(), vCurrentResult.end()));
+	return true;
 }
 
 template <typename T, bool t_bPermutations>
-inline void GenerateCombinationsAndPermutationsStaticMemoryHelper(std::vector<T*>& vResults, T* pCurrentResult, int nCurrentResultSize, const std::vector<T>& vObjects, int nResultSlots, int nStartSlot)
+CCombinationGenerator<T, t_bPermutations>::CCombinationGenerator(const std::vector<T>& vObjects, int nResultSlots, uint64_t nFirstRank)
+: m_vSortedObjects(vObjects)
+, m_nResultSlots(nResultSlots)
 {
-	if (nStartSlot >= static_cast<int>(vObjects.size()))
+	std::sort(m_vSortedObjects.begin(), m_vSortedObjects.end());
+	m_bDone = (vObjects.empty() || nResultSlots <= 0 || nResultSlots > static_cast<int>(vObjects.size()));
+	if (m_bDone || nFirstRank == 0)
 		return;
 
-	for (int nSlot = nStartSlot ; nSlot < static_cast<int>(vObjects.size()) ; ++nSlot)
+	const int nNumObjects = static_cast<int>(m_vSortedObjects.size());
+	const uint64_t nNumResults = t_bPermutations ? GetNumPermutations(nNumObjects, m_nResultSlots) : GetNumCombinations(nNumObjects, m_nResultSlots);
+	if (nFirstRank >= nNumResults)
+	{
+		m_bDone = true;
+		return;
+	}
+
+	// Start on the first result's combination, with that result waiting to be handed out by Next
+	const uint64_t nNumOrders = t_bPermutations ? GetNumPermutations(m_nResultSlots, m_nResultSlots) : 1;
+	m_vIndices.resize(m_nResultSlots);
+	UnrankCombination(m_vIndices.data(), nNumObjects, m_nResultSlots, nFirstRank / nNumOrders);
+
+	std::vector<int> vOrder(m_nResultSlots);
+	UnrankPermutation(vOrder.data(), m_nResultSlots, nFirstRank % nNumOrders);
+
+	m_vPermutation.resize(m_nResultSlots);
+	for (int nSlot = 0 ; nSlot < m_nResultSlots ; ++nSlot)
+	{
+		m_vPermutation[nSlot] = m_vSortedObjects[m_vIndices[vOrder[nSlot]]];
+	}
+	m_bStarted = true;
+	m_bPending = true;
+}
+
+template <typename T, bool t_bPermutations>
+inline bool CCombinationGenerator<T, t_bPermutations>::Next(T* pResult)
+{
+	if (m_bDone)
+		return false;
+
+	if (m_bPending)
+	{
+		m_bPending = false;
+		std::copy(m_vPermutation.begin(), m_vPermutation.end(), pResult);
+		return true;
+	}
+
+	// Permutations of the current combination come before the next combination
+	if (t_bPermutations && m_bStarted && std::next_permutation(m_vPermutation.begin(), m_vPermutation.end()))
+	{
+		std::copy(m_vPermutation.begin(), m_vPermutation.end(), pResult);
+		return true;
+	}
+
+	if (!m_bStarted)
 	{
-		const int nSlotsLeft = static_cast<int>(vObjects.size()) - nSlot;
-		if (nSlotsLeft + nCurrentResultSize < nResultSlots)
+		m_vIndices.resize(m_nResultSlots);
+		for (int nSlot = 0 ; nSlot < m_nResultSlots ; ++nSlot)
 		{
-			return;
+			m_vIndices[nSlot] = nSlot;
 		}
-		
-		pCurrentResult[nCurrentResultSize] = vObjects[nSlot];
-		if (nCurrentResultSize + 1 >= nResultSlots)
+		m_bStarted = true;
+	}
+	else
+	{
+		// Bump the last index that still has room, everything after it restarts right behind it
+		const int nNumObjects = static_cast<int>(m_vSortedObjects.size());
+		int nSlot = m_nResultSlots - 1;
+		while (nSlot >= 0 && m_vIndices[nSlot] == nNumObjects - m_nResultSlots + nSlot)
 		{
-			if (t_bPermutations)
-			{
-				GeneratePermutationsStaticMemory(vResults, pCurrentResult, nResultSlots);
-			}
-			else
-			{
-				T* pNewResult = CMemory<T>::Alloc(nResultSlots);
-				memcpy(pNewResult, pCurrentResult, nResultSlots * sizeof(T));
-				vResults.push_back(pNewResult);
-			}
+			--nSlot;
 		}
-		else
+		if (nSlot < 0)
 		{
-			GenerateCombinationsAndPermutationsStaticMemoryHelper<T, t_bPermutations>(vResults, pCurrentResult, nCurrentResultSize + 1, vObjects, nResultSlots, nSlot + 1);
+			m_bDone = true;
+			return false;
 		}
+
+		++m_vIndices[nSlot];
+		for (++nSlot ; nSlot < m_nResultSlots ; ++nSlot)
+		{
+			m_vIndices[nSlot] = m_vIndices[nSlot - 1] + 1;
+		}
+	}
+
+	m_vPermutation.resize(m_nResultSlots);
+	for (int nSlot = 0 ; nSlot < m_nResultSlots ; ++nSlot)
+	{
+		m_vPermutation[nSlot] = m_vSortedObjects[m_vIndices[nSlot]];
 	}
+	std::copy(m_vPermutation.begin(), m_vPermutation.end(), pResult);
+	return true;
 }
 
-template <typename T, bool t_bPermutations>
-inline std::vector<T*> GenerateCombinationsAndPermutationsStaticMemory(const std::vector<T>& vObjects, int nResultSlots)
+template <typename TWork>
+inline void RunOnThreads(int nNumThreads, const TWork& fnWork)
 {
-	std::vector<T*> vResults;
-	if (vObjects.empty() || nResultSlots <= 0)
-		return vResults;
+	if (nNumThreads <= 1)
+	{
+		fnWork(0);
+		return;
+	}
 
-	std::vector<T> vSortedObjects = vObjects;
-	std::sort(vSortedObjects.begin(), vSortedObjects.end());
+	std::vector<std::thread> vThreads;
+	for (int nThread = 0 ; nThread < nNumThreads ; ++nThread)
+	{
+		vThreads.emplace_back([&fnWork, nThread]()
+		{
+			fnWork(nThread);
+		});
+	}
 
-	std::vector<T> vCurrentResult(nResultSlots);
-	GenerateCombinationsAndPermutationsStaticMemoryHelper<T, t_bPermutations>(vResults, vCurrentResult.data(), 0, vSortedObjects, nResultSlots, 0);
-	return vResults;
+	for (std::thread& thread : vThreads)
+	{
+		thread.join();
+	}
+}
+
+template <typename TWork>
+inline void ParallelForChunks(int64_t nBegin, int64_t nEnd, int64_t nChunkSize, int nNumThreads, const TWork& fnWork)
+{
+	if (nEnd <= nBegin)
+		return;
+
+	nChunkSize = std::max<int64_t>(nChunkSize, 1);
+	const int64_t nNumChunks = (nEnd - nBegin + nChunkSize - 1) / nChunkSize;
+	nNumThreads = static_cast<int>(std::max<int64_t>(1, std::min<int64_t>(nNumThreads, nNumChunks)));
+
+	if (nNumThreads == 1)
+	{
+		for (int64_t nChunk = 0 ; nChunk < nNumChunks ; ++nChunk)
+		{
+			fnWork(0, nBegin + nChunk * nChunkSize, std::min(nEnd, nBegin + (nChunk + 1) * nChunkSize));
+		}
+		return;
+	}
+
+	// Each thread owns a contiguous run of chunks [nFront, nBack), it takes from the front and thieves take from the back
+	struct SWorkQueue
+	{
+		std::mutex mutex;
+		int64_t nFront = 0;
+		int64_t nBack = 0;
+	};
+	std::vector<SWorkQueue> vQueues(nNumThreads);
+	for (int nThread = 0 ; nThread < nNumThreads ; ++nThread)
+	{
+		vQueues[nThread].nFront = nNumChunks * nThread / nNumThreads;
+		vQueues[nThread].nBack = nNumChunks * (nThread + 1) / nNumThreads;
+	}
+
+	auto PopChunk = [&vQueues, nNumThreads](int nThread, int64_t& nChunk) -> bool
+	{
+		{
+			SWorkQueue& queue = vQueues[nThread];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (queue.nFront < queue.nBack)
+			{
+				nChunk = queue.nFront++;
+				return true;
+			}
+		}
+
+		// Out of work, steal the back half of whichever queue has the most left
+		while (true)
+		{
+			int nVictim = -1;
+			int64_t nMostRemaining = 0;
+			for (int nOther = 0 ; nOther < nNumThreads ; ++nOther)
+			{
+				if (nOther == nThread)
+					continue;
+
+				SWorkQueue& other = vQueues[nOther];
+				std::lock_guard<std::mutex> lock(other.mutex);
+				if (other.nBack - other.nFront > nMostRemaining)
+				{
+					nMostRemaining = other.nBack - other.nFront;
+					nVictim = nOther;
+				}
+			}
+
+			if (nVictim < 0)
+				return false;
+
+			int64_t nStolenFront = 0;
+			int64_t nStolenBack = 0;
+			{
+				SWorkQueue& victim = vQueues[nVictim];
+				std::lock_guard<std::mutex> lock(victim.mutex);
+				const int64_t nRemaining = victim.nBack - victim.nFront;
+				if (nRemaining <= 0)
+					continue;
+
+				nStolenBack = victim.nBack;
+				nStolenFront = victim.nBack - (nRemaining + 1) / 2;
+				victim.nBack = nStolenFront;
+			}
+
+			SWorkQueue& queue = vQueues[nThread];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			nChunk = nStolenFront;
+			queue.nFront = nStolenFront + 1;
+			queue.nBack = nStolenBack;
+			return true;
+		}
+	};
+
+	RunOnThreads(nNumThreads, [&](int nThread)
+	{
+		int64_t nChunk = 0;
+		while (PopChunk(nThread, nChunk))
+		{
+			fnWork(nThread, nBegin + nChunk * nChunkSize, std::min(nEnd, nBegin + (nChunk + 1) * nChunkSize));
+		}
+	});
 }
@@ -5,6 +5,11 @@
 #include <Windows.h>
 #undef min
 #undef max
+#else
+#include <cerrno>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #endif // defined(_WIN32)
 
 #include <cstdio>
@@ -17,12 +22,17 @@
 #include <iostream>
 #include <numeric>
 #include <ctime>
+#include <cstdlib>
+#include <cstring>
 
 #include <libpq-fe.h>
 
 #include "Types.h"
 #include "Utils.h"
 #include "Simulation.h"
+#include "ResultsCache.h"
+#include "EnvironmentSnapshot.h"
+#include "DatabaseSession.h"
 
 SEnvironment g_Env;
 
@@ -42,9 +52,78 @@ int ReadInt(PGresult* pResult, int nRow, int nColumn)
 	return nReturn;
 }
 
-void CreateKnowledges(PGconn* pDatabaseConnection)
-{	
-	PGresult* pResult = PQexec(pDatabaseConnection, "SELECT id, name, favor_min, favor_max, interest, combo_delay, combo_length, combo_interest, combo_favor, category_id FROM knowledge;");
+// Binary format results, values are sent big endian
+int ReadBinaryInt(PGresult* pResult, int nRow, int nColumn)
+{
+	if (PQgetisnull(pResult, nRow, nColumn) || PQgetlength(pResult, nRow, nColumn) != 4)
+	{
+		printf("Failed to get value\n");
+		return 0;
+	}
+
+	const unsigned char* pData = reinterpret_cast<const unsigned char*>(PQgetvalue(pResult, nRow, nColumn));
+	return static_cast<int32_t>((static_cast<uint32_t>(pData[0]) << 24) | (static_cast<uint32_t>(pData[1]) << 16) | (static_cast<uint32_t>(pData[2]) << 8) | pData[3]);
+}
+
+double ReadBinaryDouble(PGresult* pResult, int nRow, int nColumn)
+{
+	if (PQgetisnull(pResult, nRow, nColumn) || PQgetlength(pResult, nRow, nColumn) != 8)
+	{
+		printf("Failed to get value\n");
+		return 0.0;
+	}
+
+	const unsigned char* pData = reinterpret_cast<const unsigned char*>(PQgetvalue(pResult, nRow, nColumn));
+	uint64_t nBits = 0;
+	for (int nByte = 0 ; nByte < 8 ; ++nByte)
+	{
+		nBits = (nBits << 8) | pData[nByte];
+	}
+
+	double fReturn = 0.0;
+	memcpy(&fReturn, &nBits, sizeof(fReturn));
+	return fReturn;
+}
+
+// A one dimensional int4[] without nulls: dimensions, null flag and element type, then the dimension's length and lower bound, then a length and value per element
+bool ReadBinaryKnowledgeIDs(PGresult* pResult, int nRow, int nColumn, std::vector<TKnowledgeID>& vKnowledge)
+{
+	const int nLength = PQgetlength(pResult, nRow, nColumn);
+	const unsigned char* pData = reinterpret_cast<const unsigned char*>(PQgetvalue(pResult, nRow, nColumn));
+	auto ReadInt32 = [&](int nOffset)
+	{
+		return static_cast<int32_t>((static_cast<uint32_t>(pData[nOffset]) << 24) | (static_cast<uint32_t>(pData[nOffset + 1]) << 16) | (static_cast<uint32_t>(pData[nOffset + 2]) << 8) | pData[nOffset + 3]);
+	};
+
+	vKnowledge.clear();
+	if (PQgetisnull(pResult, nRow, nColumn) || nLength < 12 || ReadInt32(0) != 1 || ReadInt32(4) != 0 || nLength < 20)
+	{
+		printf("Bad format for knowledge IDs array\n");
+		return false;
+	}
+
+	const int nNumKnowledge = ReadInt32(12);
+	if (nNumKnowledge <= 0 || nNumKnowledge > MAX_CONSTELLATION_SLOTS || nLength != 20 + nNumKnowledge * 8)
+	{
+		printf("Bad format for knowledge IDs array\n");
+		return false;
+	}
+
+	for (int nKnowledge = 0 ; nKnowledge < nNumKnowledge ; ++nKnowledge)
+	{
+		if (ReadInt32(20 + nKnowledge * 8) != 4)
+		{
+			printf("Bad format for knowledge IDs array\n");
+			vKnowledge.clear();
+			return false;
+		}
+		vKnowledge.push_back(static_cast<TKnowledgeID>(ReadInt32(24 + nKnowledge * 8)));
+	}
+	return true;
+}
+
+void CreateKnowledges(PGresult* pResult)
+{
 	if (pResult == nullptr)
 	{
 		printf("Failed to get result\n");
@@ -111,9 +190,8 @@ void CreateKnowledges(PGconn* pDatabaseConnection)
 	PQclear(pResult);
 }
 
-void CreateConstellations(PGconn* pDatabaseConnection)
+void CreateConstellations(PGresult* pResult)
 {
-	PGresult* pResult = PQexec(pDatabaseConnection, "SELECT id, slots, slot_order FROM constellations;");
 	if (pResult == nullptr)
 	{
 		printf("Failed to get result\n");
@@ -173,9 +251,8 @@ void CreateConstellations(PGconn* pDatabaseConnection)
 	PQclear(pResult);
 }
 
-void CreateTargets(PGconn* pDatabaseConnection)
+void CreateTargets(PGresult* pResult)
 {
-	PGresult* pResult = PQexec(pDatabaseConnection, "SELECT id, name, constellation_id, category_id, interest_min, interest_max, favor_min, favor_max FROM targets;");
 	if (pResult == nullptr)
 	{
 		printf("Failed to get result\n");
@@ -228,9 +305,8 @@ void CreateTargets(PGconn* pDatabaseConnection)
 	PQclear(pResult);
 }
 
-void CreateKnowledgeCategoryIDs(PGconn* pDatabaseConnection)
+void CreateKnowledgeCategoryIDs(PGresult* pResult)
 {
-	PGresult* pResult = PQexec(pDatabaseConnection, "SELECT id, name FROM categories;");
 	if (pResult == nullptr)
 	{
 		printf("Failed to get result\n");
@@ -270,45 +346,317 @@ void CreateKnowledgeCategoryIDs(PGconn* pDatabaseConnection)
 	PQclear(pResult);
 }
 
-void StoreResults(PGconn* pDatabaseConnection, const STarget& target, const STargetSolve& targetSolve)
+// Fast results are stored a version below full ones, so a full solve never takes them. Annealed results are stored under the negated
+// version, which no other solver takes and no older version collides with. Provisional results are stored with their solver's version
+// and marked provisional, every lookup skips them.
+int GetStoredResultsVersion(const STargetSolve& targetSolve)
 {
-	// Clear out the results table
+	if (targetSolve.bAnnealSolve)
 	{
-		printf("Clearing out previous results from database\n");
+		return -g_Env.nResultsVersion;
+	}
+	return targetSolve.bFastSolve ? g_Env.nResultsVersion - 1 : g_Env.nResultsVersion;
+}
 
-		char szDeleteStatement[2048];
-		snprintf(szDeleteStatement, sizeof(szDeleteStatement), "DELETE FROM results WHERE target_id=%d AND target_interest=%d AND target_favor=%d;", target.nID, targetSolve.nInterestLevel, targetSolve.nFavor);
+// Results versions a solve can use instead of solving, best first. Full results are good enough for every solver, the approximate
+// solvers only take their own otherwise.
+std::vector<int> GetUsableResultsVersions(const STargetSolve& targetSolve)
+{
+	std::vector<int> vVersions = { g_Env.nResultsVersion };
+	if (GetStoredResultsVersion(targetSolve) != g_Env.nResultsVersion)
+	{
+		vVersions.push_back(GetStoredResultsVersion(targetSolve));
+	}
+	return vVersions;
+}
+
+bool IsUsableResultsVersion(const STargetSolve& targetSolve, int nVersion)
+{
+	const std::vector<int> vVersions = GetUsableResultsVersions(targetSolve);
+	return std::find(vVersions.begin(), vVersions.end(), nVersion) != vVersions.end();
+}
 
-		PGresult* pResult = PQexec(pDatabaseConnection, szDeleteStatement);
-		const auto eResult = PQresultStatus(pResult);
-		if (eResult != PGRES_COMMAND_OK)
+// Results blobs pack every goal param of a target state into one row of
+//   results_blobs (target_id int, target_interest int, target_favor int, version int, provisional bool, blob bytea, PRIMARY KEY (target_id, target_interest, target_favor))
+// Format 1 is a format byte, the goal param count of each goal, then runs of consecutive goal params (in goal order) that share a permutation:
+// - Run length
+// - 0 for goal params without results, 1 for a new permutation followed by its length and the zigzag deltas between its knowledge IDs,
+//   or 2 + the index of an earlier run's permutation
+// - Success percentage in 1/10000ths and zigzag strict EV in 1/100ths for each goal param of the run, the precision of the results table
+static const unsigned char s_nResultsBlobFormat = 1;
+
+void WriteBlobVarint(std::string& sBlob, uint64_t nValue)
+{
+	while (nValue >= 0x80)
+	{
+		sBlob.push_back(static_cast<char>((nValue & 0x7F) | 0x80));
+		nValue >>= 7;
+	}
+	sBlob.push_back(static_cast<char>(nValue));
+}
+
+void WriteBlobZigzag(std::string& sBlob, int64_t nValue)
+{
+	WriteBlobVarint(sBlob, (static_cast<uint64_t>(nValue) << 1) ^ static_cast<uint64_t>(nValue >> 63));
+}
+
+bool ReadBlobVarint(const unsigned char*& pBlob, const unsigned char* pBlobEnd, uint64_t& nValue)
+{
+	nValue = 0;
+	for (int nShift = 0 ; nShift < 64 ; nShift += 7)
+	{
+		if (pBlob == pBlobEnd)
 		{
-			printf("Delete failed: %s\n", PQresultErrorMessage(pResult));
-			PQclear(pResult);
-			return;
+			return false;
+		}
+		const unsigned char nByte = *pBlob++;
+		nValue |= static_cast<uint64_t>(nByte & 0x7F) << nShift;
+		if ((nByte & 0x80) == 0)
+		{
+			return true;
 		}
-		PQclear(pResult);
 	}
-	
+	return false;
+}
+
+bool ReadBlobZigzag(const unsigned char*& pBlob, const unsigned char* pBlobEnd, int64_t& nValue)
+{
+	uint64_t nEncoded = 0;
+	if (!ReadBlobVarint(pBlob, pBlobEnd, nEncoded))
+	{
+		return false;
+	}
+	nValue = static_cast<int64_t>(nEncoded >> 1) ^ -static_cast<int64_t>(nEncoded & 1);
+	return true;
+}
+
+void EncodeResultsBlob(std::string& sBlob, const SBestCombinations& bestCombinations)
+{
+	sBlob.clear();
+	sBlob.push_back(static_cast<char>(s_nResultsBlobFormat));
+	WriteBlobVarint(sBlob, NUM_GOALS);
+
+	std::vector<const SBestCombinations::SBestCombination*> vBest;
+	for (const auto& vGoalBest : bestCombinations.aBestCombinations)
 	{
-		printf("Storing best results in database\n");
+		WriteBlobVarint(sBlob, vGoalBest.size());
+		for (const SBestCombinations::SBestCombination& best : vGoalBest)
+		{
+			vBest.push_back(&best);
+		}
+	}
 
+	std::vector<const std::vector<TKnowledgeID>*> vPermutations;
+	for (size_t zRunBegin = 0 ; zRunBegin < vBest.size() ; )
+	{
+		const std::vector<TKnowledgeID>& vKnowledge = vBest[zRunBegin]->vKnowledge;
+		size_t zRunEnd = zRunBegin + 1;
+		while (zRunEnd < vBest.size() && vBest[zRunEnd]->vKnowledge == vKnowledge)
 		{
-			char szBeginTransaction[2048];
-			snprintf(szBeginTransaction, sizeof(szBeginTransaction), "BEGIN;");
+			++zRunEnd;
+		}
+		WriteBlobVarint(sBlob, zRunEnd - zRunBegin);
 
-			PGresult* pResult = PQexec(pDatabaseConnection, szBeginTransaction);
-			const auto eResult = PQresultStatus(pResult);
-			if (eResult != PGRES_COMMAND_OK)
+		if (vKnowledge.empty())
+		{
+			WriteBlobVarint(sBlob, 0);
+			zRunBegin = zRunEnd;
+			continue;
+		}
+
+		auto itPermutation = std::find_if(vPermutations.begin(), vPermutations.end(), [&](const std::vector<TKnowledgeID>* pPermutation) { return *pPermutation == vKnowledge; });
+		if (itPermutation != vPermutations.end())
+		{
+			WriteBlobVarint(sBlob, 2 + (itPermutation - vPermutations.begin()));
+		}
+		else
+		{
+			WriteBlobVarint(sBlob, 1);
+			WriteBlobVarint(sBlob, vKnowledge.size());
+			int64_t nPreviousID = 0;
+			for (TKnowledgeID nKnowledgeID : vKnowledge)
 			{
-				printf("Transaction failed: %s, query: %s\n", PQresultErrorMessage(pResult), szBeginTransaction);
-				PQclear(pResult);
-				return;
+				WriteBlobZigzag(sBlob, static_cast<int64_t>(nKnowledgeID) - nPreviousID);
+				nPreviousID = nKnowledgeID;
+			}
+			vPermutations.push_back(&vKnowledge);
+		}
+
+		for (size_t zBest = zRunBegin ; zBest < zRunEnd ; ++zBest)
+		{
+			WriteBlobVarint(sBlob, static_cast<uint64_t>(std::max(std::llround(vBest[zBest]->fSuccessPercentage * 10000.0), 0LL)));
+			WriteBlobZigzag(sBlob, std::llround(vBest[zBest]->fStrictEV * 100.0));
+		}
+		zRunBegin = zRunEnd;
+	}
+}
+
+bool DecodeResultsBlob(SBestCombinations& bestCombinations, const unsigned char* pBlob, size_t zBlobSize)
+{
+	const unsigned char* pBlobEnd = pBlob + zBlobSize;
+	uint64_t nNumGoals = 0;
+	if (zBlobSize == 0 || *pBlob++ != s_nResultsBlobFormat || !ReadBlobVarint(pBlob, pBlobEnd, nNumGoals) || nNumGoals != NUM_GOALS)
+	{
+		printf("Unknown results blob format\n");
+		return false;
+	}
+
+	std::vector<SBestCombinations::SBestCombination*> vBest;
+	for (auto& vGoalBest : bestCombinations.aBestCombinations)
+	{
+		uint64_t nNumGoalParams = 0;
+		if (!ReadBlobVarint(pBlob, pBlobEnd, nNumGoalParams) || nNumGoalParams != vGoalBest.size())
+		{
+			printf("Results blob goal params don't match\n");
+			return false;
+		}
+		for (SBestCombinations::SBestCombination& best : vGoalBest)
+		{
+			vBest.push_back(&best);
+		}
+	}
+
+	std::vector<std::vector<TKnowledgeID>> vPermutations;
+	for (size_t zRunBegin = 0 ; zRunBegin < vBest.size() ; )
+	{
+		uint64_t nRunLength = 0;
+		uint64_t nPermutation = 0;
+		if (!ReadBlobVarint(pBlob, pBlobEnd, nRunLength) || nRunLength == 0 || nRunLength > vBest.size() - zRunBegin || !ReadBlobVarint(pBlob, pBlobEnd, nPermutation))
+		{
+			printf("Bad results blob\n");
+			return false;
+		}
+		const size_t zRunEnd = zRunBegin + static_cast<size_t>(nRunLength);
+
+		if (nPermutation == 0)
+		{
+			for (size_t zBest = zRunBegin ; zBest < zRunEnd ; ++zBest)
+			{
+				*vBest[zBest] = SBestCombinations::SBestCombination();
 			}
-			PQclear(pResult);
+			zRunBegin = zRunEnd;
+			continue;
 		}
 
-		std::string sBulkStoreStatement = "INSERT INTO results (target_id, target_interest, target_favor, goal, goal_param, knowledge_ids, success_percentage, strict_afl_ev, version) VALUES ";
+		if (nPermutation == 1)
+		{
+			uint64_t nNumKnowledge = 0;
+			if (!ReadBlobVarint(pBlob, pBlobEnd, nNumKnowledge) || nNumKnowledge == 0 || nNumKnowledge > MAX_CONSTELLATION_SLOTS)
+			{
+				printf("Bad results blob\n");
+				return false;
+			}
+
+			std::vector<TKnowledgeID> vKnowledge;
+			int64_t nKnowledgeID = 0;
+			for (uint64_t nKnowledge = 0 ; nKnowledge < nNumKnowledge ; ++nKnowledge)
+			{
+				int64_t nDelta = 0;
+				if (!ReadBlobZigzag(pBlob, pBlobEnd, nDelta))
+				{
+					printf("Bad results blob\n");
+					return false;
+				}
+				nKnowledgeID += nDelta;
+				vKnowledge.push_back(static_cast<TKnowledgeID>(nKnowledgeID));
+			}
+			vPermutations.push_back(vKnowledge);
+			nPermutation = vPermutations.size() + 1;
+		}
+
+		if (nPermutation - 2 >= vPermutations.size())
+		{
+			printf("Bad results blob\n");
+			return false;
+		}
+
+		for (size_t zBest = zRunBegin ; zBest < zRunEnd ; ++zBest)
+		{
+			uint64_t nSuccess = 0;
+			int64_t nStrictEV = 0;
+			if (!ReadBlobVarint(pBlob, pBlobEnd, nSuccess) || !ReadBlobZigzag(pBlob, pBlobEnd, nStrictEV))
+			{
+				printf("Bad results blob\n");
+				return false;
+			}
+			vBest[zBest]->vKnowledge = vPermutations[static_cast<size_t>(nPermutation - 2)];
+			vBest[zBest]->fSuccessPercentage = static_cast<double>(nSuccess) / 10000.0;
+			vBest[zBest]->fStrictEV = static_cast<double>(nStrictEV) / 100.0;
+		}
+		zRunBegin = zRunEnd;
+	}
+
+	return pBlob == pBlobEnd;
+}
+
+// Queues replacing the target state's results blob, the caller clears out its result rows in the same transaction
+void QueueStoreResultsBlob(CDatabaseSession& databaseSession, const STargetSolve& targetSolve, int nVersion)
+{
+	std::string sBlob;
+	EncodeResultsBlob(sBlob, targetSolve.bestCombinations);
+	printf("Storing %d byte results blob\n", static_cast<int>(sBlob.size()));
+
+	const std::vector<std::string> vParams = { std::to_string(targetSolve.nTargetID), std::to_string(targetSolve.nInterestLevel), std::to_string(targetSolve.nFavor), std::to_string(nVersion),
+		targetSolve.bProvisional ? "true" : "false", sBlob };
+	const std::vector<int> vParamFormats = { 0, 0, 0, 0, 0, 1 };
+	databaseSession.Queue("INSERT INTO results_blobs (target_id, target_interest, target_favor, version, provisional, blob) VALUES ($1, $2, $3, $4, $5, $6) "
+		"ON CONFLICT (target_id, target_interest, target_favor) DO UPDATE SET version=EXCLUDED.version, provisional=EXCLUDED.provisional, blob=EXCLUDED.blob;", vParams, vParamFormats);
+}
+
+// Every goal param of the target state from its results blob, if it has one of a version the target solve accepts that isn't provisional
+bool FetchResultsBlob(CDatabaseSession& databaseSession, STargetSolve& targetSolve, int* pVersion)
+{
+	// Binary results, so the blob comes back as raw bytes
+	const std::vector<std::string> vParams = { std::to_string(targetSolve.nTargetID), std::to_string(targetSolve.nInterestLevel), std::to_string(targetSolve.nFavor) };
+	PGresult* pResult = databaseSession.ExecPrepared("fetch_results_blob", "SELECT version::int4, blob FROM results_blobs WHERE target_id=$1 AND target_interest=$2 AND target_favor=$3 AND NOT provisional;", vParams, 1);
+	bool bFetched = false;
+	if (PQresultStatus(pResult) == PGRES_TUPLES_OK && PQntuples(pResult) == 1)
+	{
+		const int nVersion = ReadBinaryInt(pResult, 0, 0);
+		if (IsUsableResultsVersion(targetSolve, nVersion))
+		{
+			SBestCombinations bestCombinations;
+			if (DecodeResultsBlob(bestCombinations, reinterpret_cast<const unsigned char*>(PQgetvalue(pResult, 0, 1)), static_cast<size_t>(PQgetlength(pResult, 0, 1))))
+			{
+				targetSolve.bestCombinations = bestCombinations;
+				if (pVersion != nullptr)
+				{
+					*pVersion = nVersion;
+				}
+				bFetched = true;
+			}
+		}
+	}
+	PQclear(pResult);
+
+	return bFetched;
+}
+
+// Queues replacing the target state's stored results as one transaction, they're stored by the session's next Flush()
+void QueueStoreResults(CDatabaseSession& databaseSession, const STarget& target, const STargetSolve& targetSolve)
+{
+	printf("Storing best results in database\n");
+
+	// Clear out the results table
+	{
+		char szDeleteStatement[2048];
+		snprintf(szDeleteStatement, sizeof(szDeleteStatement), "DELETE FROM results WHERE target_id=%d AND target_interest=%d AND target_favor=%d;", target.nID, targetSolve.nInterestLevel, targetSolve.nFavor);
+		databaseSession.Queue(szDeleteStatement);
+	}
+
+	const int nVersion = GetStoredResultsVersion(targetSolve);
+	if (g_Env.bStoreResultsBlobs)
+	{
+		QueueStoreResultsBlob(databaseSession, targetSolve, nVersion);
+	}
+	else
+	{
+		// A blob stored while blobs were on would otherwise still be found by lookups with them on
+		char szDeleteStatement[2048];
+		snprintf(szDeleteStatement, sizeof(szDeleteStatement), "DELETE FROM results_blobs WHERE target_id=%d AND target_interest=%d AND target_favor=%d;", target.nID, targetSolve.nInterestLevel, targetSolve.nFavor);
+		databaseSession.Queue(szDeleteStatement);
+
+		std::string sBulkStoreStatement = "INSERT INTO results (target_id, target_interest, target_favor, goal, goal_param, knowledge_ids, success_percentage, strict_afl_ev, version, provisional) VALUES ";
 
 		for (int nGoal = 0 ; nGoal < NUM_GOALS ; ++nGoal)
 		{
@@ -340,8 +688,9 @@ void StoreResults(PGconn* pDatabaseConnection, const STarget& target, const STar
 
 				// New, bulk insert
 				char szBulkInsert[2048];
-				snprintf(szBulkInsert, sizeof(szBulkInsert), "(%d, %d, %d, %d, %d, '%s', %.4f, %.2f, %d),", 
-					target.nID, targetSolve.nInterestLevel, targetSolve.nFavor, nGoal, nGoalParam, szKnowledgeIDs, best.fSuccessPercentage, best.fStrictEV, targetSolve.bFastSolve ? g_Env.nResultsVersion - 1 : g_Env.nResultsVersion);
+				snprintf(szBulkInsert, sizeof(szBulkInsert), "(%d, %d, %d, %d, %d, '%s', %.4f, %.2f, %d, %s),", 
+					target.nID, targetSolve.nInterestLevel, targetSolve.nFavor, nGoal, nGoalParam, szKnowledgeIDs, best.fSuccessPercentage, best.fStrictEV, nVersion,
+					targetSolve.bProvisional ? "true" : "false");
 				sBulkStoreStatement += szBulkInsert;
 
 				// Old, single insert
@@ -366,157 +715,422 @@ void StoreResults(PGconn* pDatabaseConnection, const STarget& target, const STar
 		}
 
 		sBulkStoreStatement[sBulkStoreStatement.length() - 1] = ';';
+		databaseSession.Queue(sBulkStoreStatement);
+	}
+
+	{
+		char szUpdateQuery[2048];
+		snprintf(szUpdateQuery, sizeof(szUpdateQuery), "UPDATE targets SET has_results=true WHERE id=%d;", target.nID);
+		databaseSession.Queue(szUpdateQuery);
+	}
+
+	databaseSession.EndTransaction();
+}
+
+// Result rows are fetched with prepared statements and binary results, the columns are cast so their binary formats are known
+bool FetchResults(CDatabaseSession& databaseSession, STargetSolve& targetSolve, EGoal eGoal, int nGoalParam, int* pVersion = nullptr)
+{
+	// Target states stored before blobs were turned on still have result rows
+	if (g_Env.bStoreResultsBlobs && FetchResultsBlob(databaseSession, targetSolve, pVersion))
+	{
+		return !targetSolve.bestCombinations.aBestCombinations[eGoal][nGoalParam].vKnowledge.empty();
+	}
+
+	const std::vector<std::string> vParams = { std::to_string(targetSolve.nTargetID), std::to_string(targetSolve.nInterestLevel), std::to_string(targetSolve.nFavor),
+		std::to_string(static_cast<int>(eGoal)), std::to_string(nGoalParam) };
+	PGresult* pResult = databaseSession.ExecPrepared("fetch_result", "SELECT knowledge_ids::int4[], success_percentage::float8, strict_afl_ev::float8, version::int4 FROM results "
+		"WHERE target_id=$1 AND target_interest=$2 AND target_favor=$3 AND goal=$4 AND goal_param=$5 AND NOT provisional;", vParams, 1);
+
+	bool bFetched = false;
+	const auto eResult = PQresultStatus(pResult);
+	if (eResult == PGRES_TUPLES_OK)
+	{
+		const int nRows = PQntuples(pResult);
+		if (nRows == 1)
 		{
-			PGresult* pResult = PQexec(pDatabaseConnection, sBulkStoreStatement.c_str());
-			const auto eResult = PQresultStatus(pResult);
-			if (eResult != PGRES_COMMAND_OK)
+			const int nVersion = ReadBinaryInt(pResult, 0, 3);
+			SBestCombinations::SBestCombination& bestCombination = targetSolve.bestCombinations.aBestCombinations[eGoal][nGoalParam];
+			if (IsUsableResultsVersion(targetSolve, nVersion) && ReadBinaryKnowledgeIDs(pResult, 0, 0, bestCombination.vKnowledge))
 			{
-				printf("Insert failed: %s, query: %s\n", PQresultErrorMessage(pResult), sBulkStoreStatement.c_str());
-				PQclear(pResult);
-				return;
+				bestCombination.fSuccessPercentage = ReadBinaryDouble(pResult, 0, 1);
+				bestCombination.fStrictEV = ReadBinaryDouble(pResult, 0, 2);
+				if (pVersion != nullptr)
+				{
+					*pVersion = nVersion;
+				}
+				bFetched = true;
 			}
-
-			PQclear(pResult);
 		}
+		else if (nRows > 1)
+		{
+			printf("Received more than 1 result row, don't know how to handle this: target %d, %d/%d, goal %d, goal param %d\n", targetSolve.nTargetID, targetSolve.nInterestLevel,
+				targetSolve.nFavor, static_cast<int>(eGoal), nGoalParam);
+		}
+	}
+	else
+	{
+		printf("Failed to fetch results: %s\n", PQresultErrorMessage(pResult));
+	}
+
+	PQclear(pResult);
+
+	return bFetched;
+}
+
+// Every goal param of the target state in one round trip, for consumers that want more than one. Goal params without stored results are left empty,
+// and so are all of them if the target state's results are provisional.
+bool FetchAllResults(CDatabaseSession& databaseSession, STargetSolve& targetSolve, int* pVersion = nullptr)
+{
+	if (g_Env.bStoreResultsBlobs && FetchResultsBlob(databaseSession, targetSolve, pVersion))
+	{
+		return true;
+	}
+
+	const std::vector<std::string> vParams = { std::to_string(targetSolve.nTargetID), std::to_string(targetSolve.nInterestLevel), std::to_string(targetSolve.nFavor) };
+	PGresult* pResult = databaseSession.ExecPrepared("fetch_results", "SELECT goal::int4, goal_param::int4, knowledge_ids::int4[], success_percentage::float8, strict_afl_ev::float8, version::int4 "
+		"FROM results WHERE target_id=$1 AND target_interest=$2 AND target_favor=$3 AND NOT provisional;", vParams, 1);
 
+	// A target state's rows are all stored with the same version, rows a full solve can't use aren't kept
+	bool bFetched = false;
+	if (PQresultStatus(pResult) == PGRES_TUPLES_OK)
+	{
+		const int nRows = PQntuples(pResult);
+		for (int nRow = 0 ; nRow < nRows ; ++nRow)
 		{
-			char szCommitTransaction[2048];
-			snprintf(szCommitTransaction, sizeof(szCommitTransaction), "COMMIT;");
+			const int nGoal = ReadBinaryInt(pResult, nRow, 0);
+			const int nGoalParam = ReadBinaryInt(pResult, nRow, 1);
+			const int nVersion = ReadBinaryInt(pResult, nRow, 5);
+			if (nGoal < 0 || nGoal >= NUM_GOALS || nGoalParam < 0 || nGoalParam >= static_cast<int>(targetSolve.bestCombinations.aBestCombinations[nGoal].size()) ||
+				!IsUsableResultsVersion(targetSolve, nVersion))
+			{
+				continue;
+			}
 
-			PGresult* pResult = PQexec(pDatabaseConnection, szCommitTransaction);
-			const auto eResult = PQresultStatus(pResult);
-			if (eResult != PGRES_COMMAND_OK)
+			SBestCombinations::SBestCombination& bestCombination = targetSolve.bestCombinations.aBestCombinations[nGoal][nGoalParam];
+			if (!ReadBinaryKnowledgeIDs(pResult, nRow, 2, bestCombination.vKnowledge))
 			{
-				printf("Transaction failed: %s, query: %s\n", PQresultErrorMessage(pResult), szCommitTransaction);
-				PQclear(pResult);
-				return;
+				continue;
 			}
-			PQclear(pResult);
+			bestCombination.fSuccessPercentage = ReadBinaryDouble(pResult, nRow, 3);
+			bestCombination.fStrictEV = ReadBinaryDouble(pResult, nRow, 4);
+			if (pVersion != nullptr)
+			{
+				*pVersion = nVersion;
+			}
+			bFetched = true;
 		}
+	}
+	else
+	{
+		printf("Failed to fetch results: %s\n", PQresultErrorMessage(pResult));
+	}
 
-		{
-			char szUpdateQuery[2048];
-			snprintf(szUpdateQuery, sizeof(szUpdateQuery), "UPDATE targets SET has_results=true WHERE id=%d;", target.nID);
+	PQclear(pResult);
+
+	return bFetched;
+}
+
+// Every distinct stored permutation of the cells within the warm start radius of the target solves, of any results version.
+// Several cells of one target are fetched in one query, over the box that covers all of their radii.
+void FetchNeighbourPermutations(CDatabaseSession& databaseSession, const STargetSolve* pTargetSolves, int nNumCells, std::vector<std::vector<TKnowledgeID>>& vPermutations)
+{
+	if (nNumCells <= 0)
+	{
+		return;
+	}
+
+	int nMinInterestLevel = pTargetSolves[0].nInterestLevel;
+	int nMaxInterestLevel = pTargetSolves[0].nInterestLevel;
+	int nMinFavor = pTargetSolves[0].nFavor;
+	int nMaxFavor = pTargetSolves[0].nFavor;
+	for (int nCell = 1 ; nCell < nNumCells ; ++nCell)
+	{
+		nMinInterestLevel = std::min(nMinInterestLevel, pTargetSolves[nCell].nInterestLevel);
+		nMaxInterestLevel = std::max(nMaxInterestLevel, pTargetSolves[nCell].nInterestLevel);
+		nMinFavor = std::min(nMinFavor, pTargetSolves[nCell].nFavor);
+		nMaxFavor = std::max(nMaxFavor, pTargetSolves[nCell].nFavor);
+	}
+
+	const std::vector<std::string> vParams = { std::to_string(pTargetSolves[0].nTargetID), std::to_string(nMinInterestLevel - g_Env.nWarmStartRadius),
+		std::to_string(nMaxInterestLevel + g_Env.nWarmStartRadius), std::to_string(nMinFavor - g_Env.nWarmStartRadius), std::to_string(nMaxFavor + g_Env.nWarmStartRadius) };
 
-			PGresult* pResult = PQexec(pDatabaseConnection, szUpdateQuery);
-			const auto eResult = PQresultStatus(pResult);
-			if (eResult != PGRES_COMMAND_OK)
+	PGresult* pResult = databaseSession.ExecPrepared("fetch_neighbour_permutations", "SELECT DISTINCT knowledge_ids::int4[] FROM results "
+		"WHERE target_id=$1 AND target_interest BETWEEN $2 AND $3 AND target_favor BETWEEN $4 AND $5;", vParams, 1);
+	if (PQresultStatus(pResult) == PGRES_TUPLES_OK)
+	{
+		const int nRows = PQntuples(pResult);
+		for (int nRow = 0 ; nRow < nRows ; ++nRow)
+		{
+			std::vector<TKnowledgeID> vPermutation;
+			if (ReadBinaryKnowledgeIDs(pResult, nRow, 0, vPermutation))
 			{
-				printf("Transaction failed: %s, query: %s\n", PQresultErrorMessage(pResult), szUpdateQuery);
-				PQclear(pResult);
-				return;
+				vPermutations.push_back(vPermutation);
 			}
-			PQclear(pResult);
 		}
-
-		printf("Finished storing results\n");
 	}
-}
+	else
+	{
+		printf("Failed to fetch neighbouring results: %s\n", PQresultErrorMessage(pResult));
+	}
 
-bool FetchResults(PGconn* pDatabaseConnection, STargetSolve& targetSolve, EGoal eGoal, int nGoalParam)
-{
-	char szSelectStatement[2048];
-	snprintf(szSelectStatement, sizeof(szSelectStatement), "SELECT knowledge_ids, success_percentage, strict_afl_ev, version FROM results WHERE target_id=%d AND target_interest=%d AND target_favor=%d AND goal=%d AND goal_param=%d;", 
-		targetSolve.nTargetID, targetSolve.nInterestLevel, targetSolve.nFavor, static_cast<int>(eGoal), nGoalParam);
+	PQclear(pResult);
 
-	PGresult* pResult = PQexec(pDatabaseConnection, szSelectStatement);
-	const auto eResult = PQresultStatus(pResult);
-	if (eResult == PGRES_TUPLES_OK)
+	if (g_Env.bStoreResultsBlobs)
 	{
-		const int nFields = PQnfields(pResult);
-		if (nFields == 4)
+		pResult = databaseSession.ExecPrepared("fetch_neighbour_results_blobs", "SELECT blob FROM results_blobs "
+			"WHERE target_id=$1 AND target_interest BETWEEN $2 AND $3 AND target_favor BETWEEN $4 AND $5;", vParams, 1);
+		if (PQresultStatus(pResult) == PGRES_TUPLES_OK)
 		{
 			const int nRows = PQntuples(pResult);
-			if (nRows == 1)
+			for (int nRow = 0 ; nRow < nRows ; ++nRow)
 			{
-				const int nColumnKnowledgeIDs = PQfnumber(pResult, "knowledge_ids");
-				const int nColumnSuccessPercentage = PQfnumber(pResult, "success_percentage");
-				const int nColumnStrictAFLEV = PQfnumber(pResult, "strict_afl_ev");
-				const int nColumnVersion = PQfnumber(pResult, "version");
-
-				for (int nRow = 0 ; nRow < nRows ; ++nRow)
+				SBestCombinations bestCombinations;
+				if (!DecodeResultsBlob(bestCombinations, reinterpret_cast<const unsigned char*>(PQgetvalue(pResult, nRow, 0)), static_cast<size_t>(PQgetlength(pResult, nRow, 0))))
 				{
-					const int nVersion = ReadInt(pResult, nRow, nColumnVersion);
-					if (nVersion < (targetSolve.bFastSolve ? g_Env.nResultsVersion - 1 : g_Env.nResultsVersion))
-					{
-						return false;
-					}
-					SBestCombinations::SBestCombination& bestCombination = targetSolve.bestCombinations.aBestCombinations[eGoal][nGoalParam];
-					bestCombination.fStrictEV = static_cast<double>(atof(PQgetvalue(pResult, nRow, nColumnStrictAFLEV)));
-					bestCombination.fSuccessPercentage = static_cast<double>(atof(PQgetvalue(pResult, nRow, nColumnSuccessPercentage)));
-					bestCombination.vKnowledge.clear();
-					
-					const char* szKnowledgeIDsBase = PQgetvalue(pResult, nRow, nColumnKnowledgeIDs);
-					int nKnowledgeIDsBaseLen = static_cast<int>(strlen(szKnowledgeIDsBase));
-					if (szKnowledgeIDsBase[0] != '{' || szKnowledgeIDsBase[nKnowledgeIDsBaseLen - 1] != '}')
-					{
-						printf("Bad format for knowledge IDs array\n");
-						return false;
-					}
-
-					char* szKnowledgeIDs = new char[nKnowledgeIDsBaseLen - 1];
-					strncpy(szKnowledgeIDs, szKnowledgeIDsBase + 1, nKnowledgeIDsBaseLen - 2);
-					szKnowledgeIDs[nKnowledgeIDsBaseLen - 2] = '\0';
+					continue;
+				}
 
-					char* pToken = strtok(szKnowledgeIDs, ",");
-					while (pToken != nullptr)
+				for (const auto& vGoalBest : bestCombinations.aBestCombinations)
+				{
+					for (const SBestCombinations::SBestCombination& best : vGoalBest)
 					{
-						int nKnowledgeID = atoi(pToken);
-						bestCombination.vKnowledge.push_back(nKnowledgeID);
-						pToken = strtok(nullptr, ",");
+						if (!best.vKnowledge.empty() && std::find(vPermutations.begin(), vPermutations.end(), best.vKnowledge) == vPermutations.end())
+						{
+							vPermutations.push_back(best.vKnowledge);
+						}
 					}
-					return true;
 				}
 			}
-			else if (nRows > 1)
-			{
-				printf("Received more than 1 result row, don't know how to handle this: %s\n", szSelectStatement);
-			}
 		}
 		else
 		{
-			printf("Didn't get 4 fields back from the DB: %s\n", szSelectStatement);
+			printf("Failed to fetch neighbouring results blobs: %s\n", PQresultErrorMessage(pResult));
 		}
+
+		PQclear(pResult);
 	}
-	else if (eResult == PGRES_COMMAND_OK)
+}
+
+// The machine and process a solve in progress mark belongs to, so a mark left by a process that died can be told apart from a running solve
+static std::string GetHostName()
+{
+	char szHostName[256] = "";
+#if defined(_WIN32)
+	DWORD dwSize = sizeof(szHostName);
+	GetComputerNameA(szHostName, &dwSize);
+#else
+	gethostname(szHostName, sizeof(szHostName) - 1);
+#endif // defined(_WIN32)
+	return szHostName;
+}
+
+static int GetProcessID()
+{
+#if defined(_WIN32)
+	return static_cast<int>(GetCurrentProcessId());
+#else
+	return static_cast<int>(getpid());
+#endif // defined(_WIN32)
+}
+
+static bool IsProcessRunning(int nProcessID)
+{
+#if defined(_WIN32)
+	HANDLE hProcess = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, static_cast<DWORD>(nProcessID));
+	if (hProcess == nullptr)
 	{
-		printf("No data returned from query: %s\n", szSelectStatement);
+		return GetLastError() == ERROR_ACCESS_DENIED;
 	}
+	DWORD dwExitCode = 0;
+	const bool bRunning = (GetExitCodeProcess(hProcess, &dwExitCode) != FALSE && dwExitCode == STILL_ACTIVE);
+	CloseHandle(hProcess);
+	return bRunning;
+#else
+	return kill(static_cast<pid_t>(nProcessID), 0) == 0 || errno == EPERM;
+#endif // defined(_WIN32)
+}
+
+enum EMarkSolveResult
+{
+	MARK_SOLVE_MARKED,
+	MARK_SOLVE_HELD, // Another process's solve in progress mark is there
+	MARK_SOLVE_FAILED, // The database couldn't be asked, whether the target state is being solved isn't known
+};
+
+EMarkSolveResult MarkSolveInProgress(PGconn* pDatabaseConnection, STargetSolve& targetSolve)
+{
+	const std::string sHostName = GetHostName();
+	const std::string sProcessID = std::to_string(GetProcessID());
+	char szInsertStatement[2048];
+	snprintf(szInsertStatement, sizeof(szInsertStatement), "INSERT INTO solve_in_progress (target_id, target_interest, target_favor, host, pid) VALUES (%d, %d, %d, $1, $2);",
+		targetSolve.nTargetID, targetSolve.nInterestLevel, targetSolve.nFavor);
 
+	const char* aParams[2] = { sHostName.c_str(), sProcessID.c_str() };
+	PGresult* pResult = PQexecParams(pDatabaseConnection, szInsertStatement, 2, nullptr, aParams, nullptr, nullptr, 0);
+	EMarkSolveResult eMarkResult = MARK_SOLVE_MARKED;
+	if (PQresultStatus(pResult) != PGRES_COMMAND_OK)
+	{
+		// unique_violation, the mark is already there
+		const char* szSQLState = PQresultErrorField(pResult, PG_DIAG_SQLSTATE);
+		if (szSQLState != nullptr && strcmp(szSQLState, "23505") == 0)
+		{
+			eMarkResult = MARK_SOLVE_HELD;
+		}
+		else
+		{
+			printf("Failed to mark the solve in progress: %s\n", pResult != nullptr ? PQresultErrorMessage(pResult) : PQerrorMessage(pDatabaseConnection));
+			eMarkResult = MARK_SOLVE_FAILED;
+		}
+	}
 	PQclear(pResult);
 
-	return false;
+	return eMarkResult;
 }
 
-bool MarkSolveInProgress(PGconn* pDatabaseConnection, STargetSolve& targetSolve)
+// For --resume, takes over the solve in progress mark of a run that died. Only a mark left by a process of this machine that's no longer running
+// is taken over, a process elsewhere can't be checked on.
+bool TakeOverSolveInProgress(PGconn* pDatabaseConnection, STargetSolve& targetSolve)
 {
-	char szInsertStatement[2048];
-	snprintf(szInsertStatement, sizeof(szInsertStatement), "INSERT INTO solve_in_progress (target_id, target_interest, target_favor) VALUES (%d, %d, %d);",
+	char szSelect[2048];
+	snprintf(szSelect, sizeof(szSelect), "SELECT host, pid FROM solve_in_progress WHERE target_id=%d AND target_interest=%d AND target_favor=%d;",
 		targetSolve.nTargetID, targetSolve.nInterestLevel, targetSolve.nFavor);
+	PGresult* pResult = PQexec(pDatabaseConnection, szSelect);
+	if (PQresultStatus(pResult) != PGRES_TUPLES_OK || PQntuples(pResult) != 1 || PQnfields(pResult) != 2)
+	{
+		// The mark was cleared since it was found, it's free to take
+		const bool bCleared = (PQresultStatus(pResult) == PGRES_TUPLES_OK && PQntuples(pResult) == 0);
+		PQclear(pResult);
+		return bCleared && MarkSolveInProgress(pDatabaseConnection, targetSolve) == MARK_SOLVE_MARKED;
+	}
 
-	PGresult* pResult = PQexec(pDatabaseConnection, szInsertStatement);
-	const auto eResult = PQresultStatus(pResult);
+	const std::string sOwnerHostName = PQgetvalue(pResult, 0, 0);
+	const std::string sOwnerProcessID = PQgetvalue(pResult, 0, 1);
+	PQclear(pResult);
+
+	const std::string sHostName = GetHostName();
+	if (sOwnerHostName != sHostName)
+	{
+		printf("The solve in progress belongs to another machine (%s), not taking it over\n", sOwnerHostName.c_str());
+		return false;
+	}
+	if (IsProcessRunning(atoi(sOwnerProcessID.c_str())))
+	{
+		printf("The solve in progress belongs to process %s, which is still running\n", sOwnerProcessID.c_str());
+		return false;
+	}
+
+	// Only the mark that was checked is taken over, if another process took it first this one doesn't
+	const std::string sProcessID = std::to_string(GetProcessID());
+	char szUpdate[2048];
+	snprintf(szUpdate, sizeof(szUpdate), "UPDATE solve_in_progress SET pid=$1 WHERE target_id=%d AND target_interest=%d AND target_favor=%d AND host=$2 AND pid=$3;",
+		targetSolve.nTargetID, targetSolve.nInterestLevel, targetSolve.nFavor);
+	const char* aParams[3] = { sProcessID.c_str(), sHostName.c_str(), sOwnerProcessID.c_str() };
+	pResult = PQexecParams(pDatabaseConnection, szUpdate, 3, nullptr, aParams, nullptr, nullptr, 0);
+	const bool bTakenOver = (PQresultStatus(pResult) == PGRES_COMMAND_OK && atoi(PQcmdTuples(pResult)) == 1);
 	PQclear(pResult);
 
-	return (eResult == PGRES_COMMAND_OK);
+	if (bTakenOver)
+	{
+		printf("Took over the solve in progress of process %s, which is no longer running\n", sOwnerProcessID.c_str());
+	}
+	return bTakenOver;
 }
 
-void MarkSolveComplete(PGconn* pDatabaseConnection, STargetSolve& targetSolve)
+// Queued in a transaction of its own, so the mark is cleared even if storing the results failed
+void QueueMarkSolveComplete(CDatabaseSession& databaseSession, const STargetSolve& targetSolve)
 {
 	char szDeleteStatement[2048];
 	snprintf(szDeleteStatement, sizeof(szDeleteStatement), "DELETE FROM solve_in_progress WHERE target_id=%d AND target_interest=%d AND target_favor=%d;",
 		targetSolve.nTargetID, targetSolve.nInterestLevel, targetSolve.nFavor);
 
-	PGresult* pResult = PQexec(pDatabaseConnection, szDeleteStatement);
+	databaseSession.EndTransaction();
+	databaseSession.Queue(szDeleteStatement);
+	databaseSession.EndTransaction();
+}
+
+// Adds the target's interest/favor cells that don't have stored results yet, or only provisional ones
+void GetUnsolvedCells(PGconn* pDatabaseConnection, const STarget& target, bool bSolveMinimum, std::vector<std::pair<int, int>>& vCells)
+{
+	char szSelect[2048];
+	if (g_Env.bStoreResultsBlobs)
+	{
+		snprintf(szSelect, sizeof(szSelect), "select target_interest,target_favor from results where target_id=%d and goal=6 and not provisional union select target_interest,target_favor from results_blobs where target_id=%d and not provisional;",
+			target.nID, target.nID);
+	}
+	else
+	{
+		snprintf(szSelect, sizeof(szSelect), "select target_interest,target_favor from results where target_id=%d and goal=6 and not provisional;", target.nID);
+	}
+	auto pResult = PQexec(pDatabaseConnection, szSelect);
 	const auto eResult = PQresultStatus(pResult);
-	if (eResult != PGRES_COMMAND_OK)
+	if (eResult == PGRES_TUPLES_OK)
 	{
-		printf("Failed to delete from solve_in_progress table, query: %s\n", szDeleteStatement);
+		const int nFields = PQnfields(pResult);
+		if (nFields == 2)
+		{
+			const int nColumnTargetInterest = PQfnumber(pResult, "target_interest");
+			const int nColumnTargetFavor = PQfnumber(pResult, "target_favor");
+			const int nRows = PQntuples(pResult);					
+
+			for (int nInterest = target.nInterestMin ; nInterest <= (bSolveMinimum ? target.nInterestMin : target.nInterestMax) ; ++nInterest)
+			{
+				for (int nFavor = target.nFavorMin ; nFavor <= (bSolveMinimum ? target.nFavorMin : target.nFavorMax) ; ++nFavor)
+				{
+					bool bFound = false;
+					
+					for (int nRow = 0 ; nRow < nRows ; ++nRow)
+					{
+						const int nReadInterest = ReadInt(pResult, nRow, nColumnTargetInterest);
+						const int nReadFavor = ReadInt(pResult, nRow, nColumnTargetFavor);
+						if (nReadInterest == nInterest && nReadFavor == nFavor)
+						{
+							bFound = true;
+							break;
+						}
+					}
+
+					if (!bFound)
+					{
+						vCells.emplace_back(nInterest, nFavor);
+					}
+				}
+			}
+		}
 	}
 
 	PQclear(pResult);
 }
 
+// Per goal, how far the approximate solve's best combinations score below the exact solve's, using the replace rule's score
+void PrintResultsGap(const STargetSolve& exactSolve, const STargetSolve& approximateSolve)
+{
+	for (int nGoal = 0 ; nGoal < NUM_GOALS ; ++nGoal)
+	{
+		const auto& vExactBest = exactSolve.bestCombinations.aBestCombinations[nGoal];
+		const auto& vApproximateBest = approximateSolve.bestCombinations.aBestCombinations[nGoal];
+
+		int nNumMatched = 0;
+		double fMaxGap = 0.0;
+		double fTotalGap = 0.0;
+		const int nNumGoalParams = static_cast<int>(vExactBest.size());
+		for (int nGoalParam = 0 ; nGoalParam < nNumGoalParams ; ++nGoalParam)
+		{
+			const double fExactScore = vExactBest[nGoalParam].fStrictEV + vExactBest[nGoalParam].fSuccessPercentage * g_Env.fDeltaSuccessEVMultiplier;
+			const double fApproximateScore = vApproximateBest[nGoalParam].fStrictEV + vApproximateBest[nGoalParam].fSuccessPercentage * g_Env.fDeltaSuccessEVMultiplier;
+			const double fGap = std::max(fExactScore - fApproximateScore, 0.0);
+			if (fGap <= 1e-9 * std::max(1.0, std::abs(fExactScore)))
+			{
+				++nNumMatched;
+			}
+			fMaxGap = std::max(fMaxGap, fGap);
+			fTotalGap += fGap;
+		}
+
+		printf("- %s: %d/%d goal params matched, max score gap %.2f, mean score gap %.4f\n", aGoalNames[nGoal].c_str(), nNumMatched, nNumGoalParams, fMaxGap,
+			fTotalGap / std::max(nNumGoalParams, 1));
+	}
+}
+
 void main(int nArgC, const char* aArgV[])
 {
 	const char* aDatabaseConnectionKeywords[] =
@@ -536,24 +1150,61 @@ void main(int nArgC, const char* aArgV[])
 		nullptr,
 	};
 
+	// Connects the first time it's needed, a process that finds everything it needs in the snapshot and results cache never does
+	CDatabaseSession databaseSession(aDatabaseConnectionKeywords, aDatabaseConnectionValues);
+
+	// Every process, spawned solves included, starts from the snapshot when there is one, and the first to read the database writes it
+	const bool bWriteSnapshot = (nArgC >= 2 && _stricmp(aArgV[1], "WriteSnapshot") == 0);
+	if (g_Env.bLoadEnvironmentSnapshot && !bWriteSnapshot && LoadEnvironmentSnapshot(g_Env.szEnvironmentSnapshotPath))
+	{
+		printf("Read initial data from environment snapshot\n");
+	}
 	// DB connection to read data
+	else
 	{
 		printf("Reading initial data from database\n");
 
-		PGconn* pDatabaseConnection = PQconnectdbParams(aDatabaseConnectionKeywords, aDatabaseConnectionValues, 0);
-		CreateConstellations(pDatabaseConnection);
-		CreateKnowledgeCategoryIDs(pDatabaseConnection);
-		CreateTargets(pDatabaseConnection);
-		CreateKnowledges(pDatabaseConnection);
-		PQfinish(pDatabaseConnection);
+		// Knowledge is added to its category, so categories are read first
+		std::vector<PGresult*> vResults;
+		databaseSession.Queue("SELECT id, slots, slot_order FROM constellations;");
+		databaseSession.Queue("SELECT id, name FROM categories;");
+		databaseSession.Queue("SELECT id, name, constellation_id, category_id, interest_min, interest_max, favor_min, favor_max FROM targets;");
+		databaseSession.Queue("SELECT id, name, favor_min, favor_max, interest, combo_delay, combo_length, combo_interest, combo_favor, category_id FROM knowledge;");
+		databaseSession.Flush(vResults);
+		CreateConstellations(vResults[0]);
+		CreateKnowledgeCategoryIDs(vResults[1]);
+		CreateTargets(vResults[2]);
+		CreateKnowledges(vResults[3]);
 
 		printf("Finished reading initial data from database\n");
+
+		if (g_Env.bLoadEnvironmentSnapshot || bWriteSnapshot)
+		{
+			WriteEnvironmentSnapshot(g_Env.szEnvironmentSnapshotPath);
+		}
 	}
 
-	if (nArgC < 2 || _stricmp(aArgV[1], "Solve") == 0 || _stricmp(aArgV[1], "SolveFast") == 0)
+	if (nArgC < 2 || _stricmp(aArgV[1], "Solve") == 0 || _stricmp(aArgV[1], "SolveFast") == 0 || _stricmp(aArgV[1], "SolveAnneal") == 0)
 	{	
+		// A trailing --resume picks a full solve up from its checkpoint, taking over the solve in progress mark of the run that died.
+		// The other solvers don't checkpoint, so there's nothing for them to pick up.
+		if (nArgC >= 3 && _stricmp(aArgV[nArgC - 1], "--resume") == 0)
+		{
+			if (_stricmp(aArgV[1], "Solve") == 0)
+			{
+				g_Env.bResumeSolves = true;
+			}
+			else
+			{
+				printf("Only full solves checkpoint, ignoring --resume\n");
+			}
+			--nArgC;
+		}
+
+
 		STargetSolve targetSolve;
 		targetSolve.bFastSolve = (nArgC >= 2 && _stricmp(aArgV[1], "SolveFast") == 0);
+		targetSolve.bAnnealSolve = (nArgC >= 2 && _stricmp(aArgV[1], "SolveAnneal") == 0);
 		std::string sTargetName;
 		EGoal eGoal = NUM_GOALS;
 		int nGoalParam = 0;
@@ -630,6 +1281,12 @@ void main(int nArgC, const char* aArgV[])
 				nGoalParam = atoi(aArgV[6]);
 			}
 		}
+
+		// Optional time budget in seconds, results found within it are stored as provisional and a solve without a budget is started for the rest
+		if (nArgC >= 8)
+		{
+			g_Env.fSolveTimeBudget = atof(aArgV[7]);
+		}
 	
 		auto itTargetID = g_Env.mapTargetIDs.find(GetLowerString(sTargetName));
 		if (itTargetID == g_Env.mapTargetIDs.end())
@@ -647,23 +1304,46 @@ void main(int nArgC, const char* aArgV[])
 		}
 		const STarget& target = itTarget->second;
 
-		// Look up stored results if we've got them
-		bool bFetchedResults = false;
+		// Look up stored results if we've got them, the cache first so repeat lookups don't touch the database
+		CResultsCache resultsCache;
+		resultsCache.Open(g_Env.szResultsCachePath);
+		bool bFetchedResults = resultsCache.Lookup(targetSolve, eGoal, nGoalParam, GetUsableResultsVersions(targetSolve));
+		if (bFetchedResults)
+		{
+			printf("Found cached results\n");
+		}
+		else
 		{
-			PGconn* pDatabaseConnection = PQconnectdbParams(aDatabaseConnectionKeywords, aDatabaseConnectionValues, 0);
-			bFetchedResults = FetchResults(pDatabaseConnection, targetSolve, eGoal, nGoalParam);
-			PQfinish(pDatabaseConnection);
+			// Every goal param comes back in the one round trip, so they're all cached for later lookups of the same target state
+			int nVersion = 0;
+			if (FetchAllResults(databaseSession, targetSolve, &nVersion))
+			{
+				resultsCache.Insert(targetSolve, nVersion);
+				bFetchedResults = !targetSolve.bestCombinations.aBestCombinations[eGoal][nGoalParam].vKnowledge.empty();
+			}
+
+			// The other goal params mustn't stand in for best combinations of the solve
+			if (!bFetchedResults)
+			{
+				targetSolve.bestCombinations.Clear();
+			}
 		}
 
 		if (!bFetchedResults)
 		{
 			printf("Failed to lookup stored results\n");
 
-			bool bSolvingAllowed = false;
+			const EMarkSolveResult eMarkResult = MarkSolveInProgress(databaseSession.GetConnection(), targetSolve);
+			if (eMarkResult == MARK_SOLVE_FAILED)
 			{
-				PGconn* pDatabaseConnection = PQconnectdbParams(aDatabaseConnectionKeywords, aDatabaseConnectionValues, 0);
-				bSolvingAllowed = MarkSolveInProgress(pDatabaseConnection, targetSolve);
-				PQfinish(pDatabaseConnection);
+				printf("Can't tell if another process is solving for this target, refusing to solve\n");
+				return;
+			}
+
+			bool bSolvingAllowed = (eMarkResult == MARK_SOLVE_MARKED);
+			if (!bSolvingAllowed && g_Env.bResumeSolves)
+			{
+				bSolvingAllowed = TakeOverSolveInProgress(databaseSession.GetConnection(), targetSolve);
 			}
 
 			if (!bSolvingAllowed)
@@ -681,27 +1361,35 @@ void main(int nArgC, const char* aArgV[])
 #endif // defined(_WIN32)
 
 			bool bSimSuccess = false;
-			if (targetSolve.bFastSolve)
+			if (targetSolve.bAnnealSolve)
+			{
+				bSimSuccess = SimulateCombinationsAnneal(target, targetSolve);
+			}
+			else if (targetSolve.bFastSolve)
 			{
 				bSimSuccess = SimulateCombinationsFast(target, targetSolve);
 			}
 			else
 			{
+				if (g_Env.bWarmStartSolves)
+				{
+					std::vector<std::vector<TKnowledgeID>> vSeedPermutations;
+					FetchNeighbourPermutations(databaseSession, &targetSolve, 1, vSeedPermutations);
+					SeedBestCombinations(target, targetSolve, vSeedPermutations);
+				}
 				bSimSuccess = SimulateCombinations(target, targetSolve);
 			}
 
-			// Store results
+			// Store results, in the same round trip as clearing the solve in progress mark
 			if (bSimSuccess)
 			{
-				PGconn* pDatabaseConnection = PQconnectdbParams(aDatabaseConnectionKeywords, aDatabaseConnectionValues, 0);
-				StoreResults(pDatabaseConnection, target, targetSolve);
-				PQfinish(pDatabaseConnection);
+				QueueStoreResults(databaseSession, target, targetSolve);
 			}
-			
+			QueueMarkSolveComplete(databaseSession, targetSolve);
+			if (databaseSession.Flush() && bSimSuccess)
 			{
-				PGconn* pDatabaseConnection = PQconnectdbParams(aDatabaseConnectionKeywords, aDatabaseConnectionValues, 0);
-				MarkSolveComplete(pDatabaseConnection, targetSolve);
-				PQfinish(pDatabaseConnection);
+				resultsCache.Insert(targetSolve, GetStoredResultsVersion(targetSolve));
+				printf("Finished storing results\n");
 			}
 
 			if (!bSimSuccess)
@@ -709,9 +1397,79 @@ void main(int nArgC, const char* aArgV[])
 				printf("Failed to simulate\n");
 				return;
 			}
+
+			if (targetSolve.bProvisional)
+			{
+				printf("Results are provisional, spawning process to finish the solve\n");
+
+				// A full solve picks up from its checkpoint, the other solvers start over
+				const char* szSolveMode = targetSolve.bAnnealSolve ? "SolveAnneal" : (targetSolve.bFastSolve ? "SolveFast" : "Solve");
+				const bool bResume = !targetSolve.bAnnealSolve && !targetSolve.bFastSolve;
+
+#if defined(_WIN32)
+				char szCommandLine[2048];
+				snprintf(szCommandLine, sizeof(szCommandLine), "%s %s \"%s\" %d %d %d %d%s", aArgV[0], szSolveMode, sTargetName.c_str(), targetSolve.nInterestLevel,
+					targetSolve.nFavor, static_cast<int>(eGoal), nGoalParam, bResume ? " --resume" : "");
+
+				STARTUPINFO si;
+				ZeroMemory(&si, sizeof(si));
+				si.cb = sizeof(si);
+				si.dwFlags |= STARTF_USESHOWWINDOW;
+				si.wShowWindow |= SW_SHOWNOACTIVATE;
+				PROCESS_INFORMATION pi;
+				ZeroMemory(&pi, sizeof(pi));
+
+				const BOOL bCreatedProcess = CreateProcess(nullptr, szCommandLine, nullptr, nullptr, FALSE, CREATE_NEW_CONSOLE, nullptr, nullptr, &si, &pi);
+				if (bCreatedProcess == FALSE)
+				{
+					printf("CreateProcess() failed - error code %d\n", GetLastError());
+				}
+				else
+				{
+					CloseHandle(pi.hProcess);
+					CloseHandle(pi.hThread);
+				}
+#else
+				// The arguments are passed as they are, no shell sees the target name
+				std::vector<std::string> vArgs = { aArgV[0], szSolveMode, sTargetName, std::to_string(targetSolve.nInterestLevel), std::to_string(targetSolve.nFavor),
+					std::to_string(static_cast<int>(eGoal)), std::to_string(nGoalParam) };
+				if (bResume)
+				{
+					vArgs.push_back("--resume");
+				}
+				std::vector<char*> vArgV;
+				for (std::string& sArg : vArgs)
+				{
+					vArgV.push_back(&sArg[0]);
+				}
+				vArgV.push_back(nullptr);
+
+				// Forked twice so the solve is left running in the background after this process exits, and is never a child to reap
+				const pid_t nChildID = fork();
+				if (nChildID == 0)
+				{
+					setsid();
+					if (fork() == 0)
+					{
+						execvp(vArgV[0], vArgV.data());
+						_exit(127);
+					}
+					_exit(0);
+				}
+
+				if (nChildID < 0 || waitpid(nChildID, nullptr, 0) != nChildID)
+				{
+					printf("Failed to spawn process: %s\n", strerror(errno));
+				}
+#endif // defined(_WIN32)
+			}
 		}
 		
 		const SBestCombinations::SBestCombination& bestCombination = targetSolve.bestCombinations.aBestCombinations[eGoal][nGoalParam];
+		if (targetSolve.bProvisional)
+		{
+			printf("Provisional result, the solve ran out of time\n");
+		}
 		printf("Best combination - Success: %.2f%% - Strict AFL EV: %.2f\n", bestCombination.fSuccessPercentage * 100.0f, bestCombination.fStrictEV);
 		for (int nKnowledgeID : bestCombination.vKnowledge)
 		{
@@ -762,7 +1520,6 @@ void main(int nArgC, const char* aArgV[])
 			int nFavor;
 		};
 		
-		PGconn* pDatabaseConnection = PQconnectdbParams(aDatabaseConnectionKeywords, aDatabaseConnectionValues, 0);
 		std::vector<SSolveAllTarget> vTargets;
 		for (auto&& itTarget : g_Env.mapTargets)
 		{
@@ -788,46 +1545,12 @@ void main(int nArgC, const char* aArgV[])
 				continue;
 			}
 
-			char szSelect[2048];
-			snprintf(szSelect, sizeof(szSelect), "select target_interest,target_favor from results where target_id=%d and goal=6;", target.nID);
-			auto pResult = PQexec(pDatabaseConnection, szSelect);
-			const auto eResult = PQresultStatus(pResult);
-			if (eResult == PGRES_TUPLES_OK)
+			std::vector<std::pair<int, int>> vCells;
+			GetUnsolvedCells(databaseSession.GetConnection(), target, bSolveMinimum, vCells);
+			for (const auto& cell : vCells)
 			{
-				const int nFields = PQnfields(pResult);
-				if (nFields == 2)
-				{
-					const int nColumnTargetInterest = PQfnumber(pResult, "target_interest");
-					const int nColumnTargetFavor = PQfnumber(pResult, "target_favor");
-					const int nRows = PQntuples(pResult);					
-
-					for (int nInterest = target.nInterestMin ; nInterest <= (bSolveMinimum ? target.nInterestMin : target.nInterestMax) ; ++nInterest)
-					{
-						for (int nFavor = target.nFavorMin ; nFavor <= (bSolveMinimum ? target.nFavorMin : target.nFavorMax) ; ++nFavor)
-						{
-							bool bFound = false;
-					
-							for (int nRow = 0 ; nRow < nRows ; ++nRow)
-							{
-								const int nReadInterest = ReadInt(pResult, nRow, nColumnTargetInterest);
-								const int nReadFavor = ReadInt(pResult, nRow, nColumnTargetFavor);
-								if (nReadInterest == nInterest && nReadFavor == nFavor)
-								{
-									bFound = true;
-									break;
-								}
-							}
-
-							if (!bFound)
-							{
-								vTargets.emplace_back(SSolveAllTarget{target, nInterest, nFavor});
-							}
-						}
-					}
-				}
+				vTargets.emplace_back(SSolveAllTarget{target, cell.first, cell.second});
 			}
-
-			PQclear(pResult);
 		}
 		printf("Generated target list of %d targets, beginning to solve using %d processes\n", static_cast<int>(vTargets.size()), nNumProcesses);
 		
@@ -844,7 +1567,7 @@ void main(int nArgC, const char* aArgV[])
 			targetSolve.nFavor = target.nFavor;
 			targetSolve.bFastSolve = bFastSolve;
 
-			const bool bFetchedResults = FetchResults(pDatabaseConnection, targetSolve, GOAL_FREE_TALK, 0);
+			const bool bFetchedResults = FetchResults(databaseSession, targetSolve, GOAL_FREE_TALK, 0);
 			if (bFetchedResults)
 			{
 				printf("Skipping %d, already solved - %s %d/%d (%.2f%% - %.3fs elapsed)\n", nTarget, target.target.sName.c_str(), target.nInterest, target.nFavor, 
@@ -855,8 +1578,6 @@ void main(int nArgC, const char* aArgV[])
 			if (vProcesses.size() >= nNumProcesses)
 			{
 				printf("Waiting for a process to finish before spawning a new one\n");
-				PQfinish(pDatabaseConnection);
-				pDatabaseConnection = nullptr;
 
 				DWORD dwWaitID = WaitForMultipleObjects(static_cast<DWORD>(vProcesses.size()), vProcesses.data(), FALSE, INFINITE);
 				if (dwWaitID >= WAIT_OBJECT_0 && dwWaitID < WAIT_OBJECT_0 + vProcesses.size())
@@ -869,8 +1590,6 @@ void main(int nArgC, const char* aArgV[])
 					printf("WaitForMultipleObjects() failed, no idea what to do - return value %d\n", static_cast<int>(dwWaitID));
 					return;
 				}
-				
-				pDatabaseConnection = PQconnectdbParams(aDatabaseConnectionKeywords, aDatabaseConnectionValues, 0);
 			}
 			
 			printf("Spawning process to solve for target %d/%d - %s %d/%d (%.2f%% - %.3fs elapsed)\n", nTarget, static_cast<int>(vTargets.size()), target.target.sName.c_str(), target.nInterest, target.nFavor, 
@@ -902,4 +1621,176 @@ void main(int nArgC, const char* aArgV[])
 		printf("Finished solving for everything - %.3fs elapsed\n", static_cast<double>(nCurrentTime - nSolveStartTime) / CLOCKS_PER_SEC);
 #endif // defined(_WIN32)
 	}
+	else if (_stricmp(aArgV[1], "CompareAnneal") == 0)
+	{
+		// Solves one cell both ways without touching stored results, for checking annealing on categories the exact solver can still handle
+		if (nArgC < 5)
+		{
+			printf("Usage: CompareAnneal <target> <interest> <favor>\n");
+			return;
+		}
+
+		auto itTargetID = g_Env.mapTargetIDs.find(GetLowerString(aArgV[2]));
+		if (itTargetID == g_Env.mapTargetIDs.end())
+		{
+			printf("Failed to find target: %s\n", aArgV[2]);
+			return;
+		}
+
+		auto itTarget = g_Env.mapTargets.find(itTargetID->second);
+		if (itTarget == g_Env.mapTargets.end())
+		{
+			printf("Failed to find target ID: %d\n", itTargetID->second);
+			return;
+		}
+		const STarget& target = itTarget->second;
+
+		STargetSolve exactSolve;
+		exactSolve.nTargetID = target.nID;
+		exactSolve.nInterestLevel = atoi(aArgV[3]);
+		exactSolve.nFavor = atoi(aArgV[4]);
+		STargetSolve approximateSolve = exactSolve;
+
+		clock_t nStartTime = clock();
+		if (!SimulateCombinations(target, exactSolve))
+		{
+			printf("Failed to simulate\n");
+			return;
+		}
+		clock_t nExactTime = clock();
+		if (!SimulateCombinationsAnneal(target, approximateSolve))
+		{
+			printf("Failed to simulate\n");
+			return;
+		}
+		clock_t nApproximateTime = clock();
+
+		printf("Exact solve %.3fs, annealing %.3fs\n", static_cast<double>(nExactTime - nStartTime) / CLOCKS_PER_SEC, static_cast<double>(nApproximateTime - nExactTime) / CLOCKS_PER_SEC);
+		PrintResultsGap(exactSolve, approximateSolve);
+	}
+	else if (_stricmp(aArgV[1], "SolveGrid") == 0 || _stricmp(aArgV[1], "SolveGridMin") == 0)
+	{
+		// Full solve of every unsolved interest/favor cell of one target in this process, the cells share each permutation's enumeration
+		const bool bSolveMinimum = (_stricmp(aArgV[1], "SolveGridMin") == 0);
+		CResultsCache resultsCache;
+		resultsCache.Open(g_Env.szResultsCachePath);
+
+		std::string sTargetName;
+		if (nArgC < 3)
+		{
+			printf("What's the name of the target? ");
+			char szTarget[256];
+
+			std::ws(std::cin);
+			std::cin.getline(szTarget, sizeof(szTarget));
+			sTargetName = szTarget;
+		}
+		else
+		{
+			sTargetName = aArgV[2];
+		}
+
+		auto itTargetID = g_Env.mapTargetIDs.find(GetLowerString(sTargetName));
+		if (itTargetID == g_Env.mapTargetIDs.end())
+		{
+			printf("Failed to find target: %s\n", sTargetName.c_str());
+			return;
+		}
+
+		auto itTarget = g_Env.mapTargets.find(itTargetID->second);
+		if (itTarget == g_Env.mapTargets.end())
+		{
+			printf("Failed to find target ID: %d\n", itTargetID->second);
+			return;
+		}
+		const STarget& target = itTarget->second;
+
+		// The connection is asked for before each use, a solve takes long enough for the server to drop it in between
+		std::vector<std::pair<int, int>> vCells;
+		GetUnsolvedCells(databaseSession.GetConnection(), target, bSolveMinimum, vCells);
+		printf("Found %d unsolved cells for target: %s\n", static_cast<int>(vCells.size()), target.sName.c_str());
+
+		clock_t nSolveStartTime = clock();
+		for (int nFirstCell = 0 ; nFirstCell < static_cast<int>(vCells.size()) ; nFirstCell += g_Env.nGridSolveCells)
+		{
+			const int nLastCell = std::min(nFirstCell + g_Env.nGridSolveCells, static_cast<int>(vCells.size()));
+
+			// Cells another process is already solving are left to it. If the database can't say, the batch's marks are cleared and the grid stops.
+			std::vector<STargetSolve> vTargetSolves;
+			bool bMarkFailed = false;
+			for (int nCell = nFirstCell ; nCell < nLastCell && !bMarkFailed ; ++nCell)
+			{
+				STargetSolve targetSolve;
+				targetSolve.nTargetID = target.nID;
+				targetSolve.nInterestLevel = vCells[nCell].first;
+				targetSolve.nFavor = vCells[nCell].second;
+				const EMarkSolveResult eMarkResult = MarkSolveInProgress(databaseSession.GetConnection(), targetSolve);
+				if (eMarkResult == MARK_SOLVE_HELD)
+				{
+					printf("Another process is currently solving %d/%d, skipping it\n", targetSolve.nInterestLevel, targetSolve.nFavor);
+				}
+				else if (eMarkResult == MARK_SOLVE_FAILED)
+				{
+					printf("Can't tell if another process is solving %d/%d, stopping\n", targetSolve.nInterestLevel, targetSolve.nFavor);
+					bMarkFailed = true;
+				}
+				else
+				{
+					vTargetSolves.push_back(targetSolve);
+				}
+			}
+			if (bMarkFailed)
+			{
+				for (const STargetSolve& targetSolve : vTargetSolves)
+				{
+					QueueMarkSolveComplete(databaseSession, targetSolve);
+				}
+				databaseSession.Flush();
+				break;
+			}
+			if (vTargetSolves.empty())
+			{
+				continue;
+			}
+
+			// One query and one knowledge table for the whole batch, cells stored by earlier batches are neighbours of this one too
+			if (g_Env.bWarmStartSolves)
+			{
+				std::vector<std::vector<TKnowledgeID>> vSeedPermutations;
+				FetchNeighbourPermutations(databaseSession, vTargetSolves.data(), static_cast<int>(vTargetSolves.size()), vSeedPermutations);
+				SeedBestCombinationsGrid(target, vTargetSolves, vSeedPermutations);
+			}
+
+			int nCurrentTime = clock();
+			printf("Solving cells %d-%d of %d - %.3fs elapsed\n", nFirstCell, nLastCell - 1, static_cast<int>(vCells.size()), static_cast<double>(nCurrentTime - nSolveStartTime) / CLOCKS_PER_SEC);
+
+			// The whole batch is stored in one round trip
+			const bool bSimSuccess = SimulateCombinationsGrid(target, vTargetSolves);
+			for (STargetSolve& targetSolve : vTargetSolves)
+			{
+				if (bSimSuccess)
+				{
+					QueueStoreResults(databaseSession, target, targetSolve);
+				}
+				QueueMarkSolveComplete(databaseSession, targetSolve);
+			}
+			if (databaseSession.Flush() && bSimSuccess)
+			{
+				for (const STargetSolve& targetSolve : vTargetSolves)
+				{
+					resultsCache.Insert(targetSolve, GetStoredResultsVersion(targetSolve));
+				}
+				printf("Finished storing results\n");
+			}
+
+			if (!bSimSuccess)
+			{
+				printf("Failed to simulate\n");
+				break;
+			}
+		}
+
+		int nCurrentTime = clock();
+		printf("Finished solving grid - %.3fs elapsed\n", static_cast<double>(nCurrentTime - nSolveStartTime) / CLOCKS_PER_SEC);
+	}
 }